@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Define ACCEL_LOCAL_DEBUG for main() that tests on build host, e.g.
+ * gcc -o /tmp/test_accel -D ACCEL_LOCAL_DEBUG=1 -Wall accel.c
+ * With a file argument it replays a detent trace of "ms dir" lines and
+ * prints the running value instead.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "accel.h"
+
+/* Tunable curve, fastest first; see accel.h */
+static const struct accel_point accel_curve[] = {
+	{ 6,	60 },
+	{ 12,	20 },
+	{ 25,	5 },
+	{ 50,	2 },
+};
+#define ACCEL_NCURVE	(sizeof(accel_curve) / sizeof(*accel_curve))
+
+void
+accel_reset(struct accel *a)
+{
+	a->last = 0;
+	a->avg = ACCEL_AVG_NONE;
+	a->dir = 0;
+}
+
+int16_t
+accel_detent(struct accel *a, uint16_t now, int8_t dir)
+{
+	uint16_t interval = now - a->last;
+	uint8_t i;
+
+	a->last = now;
+	if (dir != a->dir || interval > ACCEL_IDLE_MS) {
+		/* First detent of a turn */
+		a->dir = dir;
+		a->avg = ACCEL_AVG_NONE;
+		return dir;
+	}
+	if (a->avg == ACCEL_AVG_NONE)
+		a->avg = interval << 4;
+	else {
+		a->avg += ((int16_t)(interval << 4) - (int16_t)a->avg) >>
+		    ACCEL_AVG_SHIFT;
+	}
+	for (i = 0; i < ACCEL_NCURVE; i++) {
+		if (a->avg <= accel_curve[i].interval << 4)
+			return dir * accel_curve[i].mult;
+	}
+	return dir;
+}
+
+#if ACCEL_LOCAL_DEBUG
+#include <err.h>
+#include <stdio.h>
+
+/* Replay 'n' detents 'interval' ms apart; return the sum of weights */
+static int
+spin(struct accel *a, uint16_t *now, int n, uint16_t interval, int8_t dir)
+{
+	int r = 0;
+
+	while (n-- > 0) {
+		*now += interval;
+		r += accel_detent(a, *now, dir);
+	}
+	return r;
+}
+
+static void
+replay(const char *path)
+{
+	FILE *f;
+	unsigned int t;
+	int dir;
+	long value = 0;
+	struct accel a;
+
+	if ((f = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	accel_reset(&a);
+	while (fscanf(f, "%u %d", &t, &dir) == 2) {
+		value += accel_detent(&a, t, dir < 0 ? -1 : 1);
+		printf("%u %d %ld\n", t, dir, value);
+	}
+	fclose(f);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct accel a;
+	uint16_t now = 65000; /* Wraps during the test */
+	int r;
+
+	if (argc > 1) {
+		replay(argv[1]);
+		return 0;
+	}
+	accel_reset(&a);
+
+	/* Slow turns step by one */
+	if ((r = spin(&a, &now, 20, 200, 1)) != 20)
+		errx(1, "%d: slow %d", __LINE__, r);
+	if ((r = spin(&a, &now, 10, 80, -1)) != -10)
+		errx(1, "%d: slow reverse %d", __LINE__, r);
+
+	/* A fast spin (one turn of 20 detents in 100ms) crosses [0:1000) */
+	now += 1000;
+	if ((r = spin(&a, &now, 20, 5, 1)) < 1000)
+		errx(1, "%d: fast %d", __LINE__, r);
+
+	/* Reversing starts again from one */
+	if ((r = accel_detent(&a, now + 5, -1)) != -1)
+		errx(1, "%d: reverse %d", __LINE__, r);
+
+	/* A pause resets acceleration */
+	now += 5;
+	if ((r = spin(&a, &now, 10, 5, -1)) >= -10)
+		errx(1, "%d: fast reverse %d", __LINE__, r);
+	if ((r = spin(&a, &now, 1, ACCEL_IDLE_MS + 1, -1)) != -1)
+		errx(1, "%d: after pause %d", __LINE__, r);
+
+	/* Acceleration is monotonic in speed */
+	accel_reset(&a);
+	if (spin(&a, &now, 10, 40, 1) > spin(&a, &now, 10, 10, 1))
+		errx(1, "%d: not monotonic", __LINE__);
+	printf("OK\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef ACCEL_H
+#define ACCEL_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Encoder acceleration: each detent is weighted by a multiplier chosen
+ * from the recent detent rate, so a fast spin sweeps a whole range while
+ * slow turns still step by one.
+ *
+ * The rate is a running average of the interval between detents, reset
+ * by a pause or a change of direction. The average is looked up in
+ * accel_curve[] (accel.c): the first entry with an interval at least the
+ * average gives the multiplier; slower than the last entry gives 1.
+ *
+ * This has no hardware dependencies so it can be tested on the build host
+ * with recorded detent traces; see ACCEL_LOCAL_DEBUG in accel.c.
+ */
+
+#include <stdint.h>
+
+/* A pause longer than this (ms) restarts acceleration */
+#define ACCEL_IDLE_MS		150
+
+/* Weight of the newest interval in the running average: 1/2^n */
+#define ACCEL_AVG_SHIFT		1
+
+struct accel_point {
+	uint8_t interval;	/* Average ms per detent at most this... */
+	uint8_t mult;		/* ...gives this multiplier */
+};
+
+#define ACCEL_AVG_NONE		0xffff	/* No interval yet */
+
+struct accel {
+	uint16_t last;		/* Time of the previous detent */
+	uint16_t avg;		/* Average interval, ms << 4 */
+	int8_t dir;		/* Direction of the previous detent or 0 */
+};
+
+/* Reset the acceleration state */
+void accel_reset(struct accel *a);
+
+/*
+ * Record a detent in direction 'dir' (+1/-1) at 'now' ms and return its
+ * weighted value.
+ */
+int16_t accel_detent(struct accel *a, uint16_t now, int8_t dir);
+
+#endif /* ACCEL_H */
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Define CONFIG_LOCAL_DEBUG for main() that tests on build host, e.g.
+ * gcc -o /tmp/test_config -D CONFIG_LOCAL_DEBUG=1 -Wall config.c
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __AVR__
+# include <util/crc16.h>
+#else
+/* As documented for avr-libc's _crc_ccitt_update() */
+static uint16_t
+_crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+	data ^= crc & 0xff;
+	data ^= data << 4;
+	return ((((uint16_t)data << 8) | (crc >> 8)) ^
+	    (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+#endif
+
+#include "config.h"
+
+static uint16_t
+config_crc(const struct config *c)
+{
+	const uint8_t *p = (const uint8_t *)c;
+	uint16_t crc = 0xffff;
+	size_t i;
+
+	for (i = 0; i < offsetof(struct config, crc); i++)
+		crc = _crc_ccitt_update(crc, p[i]);
+	return crc;
+}
+
+void
+config_seal(struct config *c)
+{
+	c->version = CONFIG_VERSION;
+	c->crc = config_crc(c);
+}
+
+static int
+value_ok(int16_t v)
+{
+	return v >= 0 && v < CONFIG_VALUE_MAX;
+}
+
+int
+config_check(const struct config *c)
+{
+	uint8_t i;
+
+	if (c->version != CONFIG_VERSION || c->crc != config_crc(c))
+		return -1;
+	if (c->mode >= MODE_MAX || c->combine >= COMBINE_MAX ||
+	    c->output >= OUT_MAX || c->phase >= PHASE_MAX)
+		return -1;
+	for (i = 0; i < 2; i++) {
+		if (c->trigger[i] >= TRIG_MAX)
+			return -1;
+	}
+	if (c->wait_unit >= DUR_MAX || c->wait2_unit >= DUR_MAX ||
+	    c->on_unit >= DUR_MAX || c->len_unit >= DUR_MAX ||
+	    c->holdoff_unit >= DUR_MAX || c->freq_unit >= RATE_MAX)
+		return -1;
+	if (!value_ok(c->wait) || !value_ok(c->wait2) || !value_ok(c->on) ||
+	    !value_ok(c->freq) || !value_ok(c->len) ||
+	    (c->holdoff != -1 && !value_ok(c->holdoff)))
+		return -1;
+	return 0;
+}
+
+int
+config_equal(const struct config *a, const struct config *b)
+{
+	return memcmp(a, b, offsetof(struct config, crc)) == 0;
+}
+
+#if CONFIG_LOCAL_DEBUG
+#include <err.h>
+#include <stdio.h>
+
+int
+main(void)
+{
+	struct config a, b;
+	uint8_t *p = (uint8_t *)&a;
+	size_t i, j;
+
+	/* The image must be the same on every compiler; see config.h */
+	if (sizeof(a) != 22 || offsetof(struct config, wait) != 8 ||
+	    offsetof(struct config, crc) != 20)
+		errx(1, "%d: layout %zu", __LINE__, sizeof(a));
+
+	memset(&a, 0, sizeof(a));
+	a.mode = MODE_STROBE;
+	a.trigger[0] = TRIG_MANUAL;
+	a.output = OUT_BOTH;
+	a.freq_unit = RATE_MILLI_HZ;
+	a.wait = 999;
+	a.holdoff = -1;
+	/* Bitfields LSB first, little-endian words */
+	if (p[1] != (MODE_STROBE | OUT_BOTH << 5) ||
+	    p[5] != RATE_MILLI_HZ << 4 ||
+	    p[8] != (999 & 0xff) || p[9] != 999 >> 8)
+		errx(1, "%d: bit or byte order", __LINE__);
+	config_seal(&a);
+	if (config_check(&a) != 0)
+		errx(1, "%d: sealed config rejected", __LINE__);
+	b = a;
+	if (!config_equal(&a, &b))
+		errx(1, "%d: copy differs", __LINE__);
+
+	/* Every single-bit error is caught, by the CRC or otherwise */
+	for (i = 0; i < sizeof(a); i++) {
+		for (j = 0; j < 8; j++) {
+			p[i] ^= 1 << j;
+			if (config_check(&a) == 0)
+				errx(1, "%d: bit %zu.%zu", __LINE__, i, j);
+			p[i] ^= 1 << j;
+		}
+	}
+
+	/* Out of range values are rejected even with a good CRC */
+	b.wait = CONFIG_VALUE_MAX;
+	config_seal(&b);
+	if (config_check(&b) == 0)
+		errx(1, "%d: range", __LINE__);
+	b = a;
+	b.trigger[1] = TRIG_MAX;
+	config_seal(&b);
+	if (config_check(&b) == 0)
+		errx(1, "%d: trigger range", __LINE__);
+	b = a;
+	b.output = OUT_PHASE;
+	b.phase = PHASE_MAX - 1;
+	config_seal(&b);
+	if (config_check(&b) != 0)
+		errx(1, "%d: phase rejected", __LINE__);
+	b.phase = PHASE_MAX;
+	config_seal(&b);
+	if (config_check(&b) == 0)
+		errx(1, "%d: phase range", __LINE__);
+	b = a;
+	b.version++;
+	b.crc = config_crc(&b);
+	if (config_check(&b) == 0)
+		errx(1, "%d: version", __LINE__);
+	printf("OK\n");
+	return 0;
+}
+#endif
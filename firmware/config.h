@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+ * Controller configuration. The same packed image is used in RAM, in
+ * EEPROM and on the wire, so it has a version byte and a CRC. Byte
+ * fields come first, then 16-bit values at even offsets, so padding
+ * doesn't change it. It does assume what avr-gcc and gcc on x86 and ARM
+ * do: bitfields are allocated from the least significant bit of their
+ * byte up, and 16-bit values are little-endian. test_config checks this.
+ */
+
+#include <stdint.h>
+
+#define MODE_ONESHOT	0
+#define MODE_STROBE	1
+#define MODE_MAX	2
+
+#define READY_NO	0
+#define READY_YES	1
+#define READY_MAX	2
+
+#define TRIG_NONE	0
+#define TRIG_CHAN_1	1
+#define TRIG_CHAN_1_NOT	2
+#define TRIG_CHAN_2	3
+#define TRIG_CHAN_2_NOT	4
+#define TRIG_MANUAL	5
+#define TRIG_CHAN_1_RISE	6	/* Edge-triggered; latched in hardware */
+#define TRIG_CHAN_1_FALL	7
+#define TRIG_CHAN_1_EDGE	8
+#define TRIG_CHAN_2_RISE	9
+#define TRIG_CHAN_2_FALL	10
+#define TRIG_CHAN_2_EDGE	11
+#define TRIG_MAX	12
+
+#define OUT_CH1		0
+#define OUT_CH2		1
+#define OUT_BOTH	2
+#define OUT_ALT		3	/* Strobe: pulses alternate CH1, CH2, ... */
+#define OUT_PHASE	4	/* Strobe: CH2 lags CH1 by phase% */
+#define OUT_MAX		5
+/* XXX inverted (for camera control) mode */
+
+/* OUT_PHASE lag, percent of the strobe period */
+#define PHASE_MAX	100
+
+#define COMBINE_NONE	0
+#define COMBINE_OR	1
+#define COMBINE_AND	2
+#define COMBINE_XOR	3
+#define COMBINE_MAX	4
+/* XXX "then" operator. E.g. "input 1 then input 2" */
+
+#define DUR_NANOSEC	0	/* Rounded to whole cycles */
+#define DUR_MICROSEC	1
+#define DUR_MILLISEC	2
+#define DUR_SEC		3
+#define DUR_MINUTE	4
+#define DUR_HOUR	5
+#define DUR_MAX		6
+
+#define RATE_MHZ	0
+#define RATE_KHZ	1
+#define RATE_HZ		2
+#define RATE_MILLI_HZ	3
+#define RATE_MAX	4
+
+/* Bump when the layout or meaning of struct config changes */
+#define CONFIG_VERSION	3
+
+/* Numeric settings are [0:CONFIG_VALUE_MAX); holdoff may also be -1 */
+#define CONFIG_VALUE_MAX	1000
+
+struct config {
+	uint8_t version;		/* CONFIG_VERSION */
+	uint8_t mode:2;
+	uint8_t ready:1;
+	uint8_t combine:2;
+	uint8_t output:3;
+	uint8_t trigger[2];
+	uint8_t wait_unit:4, wait2_unit:4;
+	uint8_t on_unit:4, freq_unit:4;
+	uint8_t len_unit:4, holdoff_unit:4;
+	uint8_t phase;			/* [0:PHASE_MAX) */
+	int16_t wait, wait2;
+	int16_t on;
+	/* Strobe */
+	int16_t freq, len;
+	/* Oneshot; -1 is manual re-arm */
+	int16_t holdoff;
+	uint16_t crc;			/* Of everything above */
+};
+
+/* Set the version and CRC of 'c' before it's stored or sent */
+void config_seal(struct config *c);
+
+/*
+ * Returns 0 if 'c' has the current version, a good CRC and every field
+ * in range, or -1 otherwise.
+ */
+int config_check(const struct config *c);
+
+/* Returns non-zero if 'a' and 'b' hold the same settings */
+int config_equal(const struct config *a, const struct config *b);
+
+#endif /* CONFIG_H */
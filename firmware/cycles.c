@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Define CYCLES_LOCAL_DEBUG for main() that tests on build host, e.g.
+ * gcc -o /tmp/test_cycles -D CYCLES_LOCAL_DEBUG=1 -DF_CPU=20000000UL \
+ *     -Wall cycles.c
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cycles.h"
+
+/* Sub-millisecond conversions below are done in 32 bits */
+#if F_CPU % 1000 != 0 || F_CPU / 1000 > UINT32_MAX / INT16_MAX
+# error F_CPU must be a whole number of kHz and under 131MHz
+#endif
+#define F_KHZ	(F_CPU / 1000)
+
+/* One 'unit' is F_KHZ * mul / div cycles */
+static const struct {
+	uint32_t mul, div;
+} dur_scale[DUR_MAX] = {
+	[DUR_NANOSEC] =		{ 1,		1000000 },
+	[DUR_MICROSEC] =	{ 1,		1000 },
+	[DUR_MILLISEC] =	{ 1,		1 },
+	[DUR_SEC] =		{ 1000,		1 },
+	[DUR_MINUTE] =		{ 60000,	1 },
+	[DUR_HOUR] =		{ 3600000,	1 },
+};
+
+cycles_t
+dur_cycles(int16_t n, uint8_t unit, uint8_t *exact)
+{
+	uint32_t c, div;
+
+	if (exact != NULL)
+		*exact = 1;
+	if (n <= 0 || unit >= DUR_MAX)
+		return 0;
+	div = dur_scale[unit].div;
+	if (div == 1)
+		return (cycles_t)n * F_KHZ * dur_scale[unit].mul;
+	c = (uint32_t)n * F_KHZ;
+	if (exact != NULL)
+		*exact = c % div == 0;
+	return (c + div / 2) / div;
+}
+
+uint64_t
+cycles_dur(cycles_t c, uint8_t unit)
+{
+	cycles_t per;
+
+	if (unit >= DUR_MAX)
+		return 0;
+	/* Sub-millisecond units go the other way to stay in 64 bits */
+	if (dur_scale[unit].div != 1)
+		return cycles_div(c * dur_scale[unit].div + F_KHZ / 2, F_KHZ);
+	per = (cycles_t)F_KHZ * dur_scale[unit].mul;
+	return cycles_div(c + per / 2, per);
+}
+
+cycles_t
+cycles_div(cycles_t a, cycles_t b)
+{
+	if (a > UINT32_MAX)
+		return a / b;
+	return b > a ? 0 : (uint32_t)a / (uint32_t)b;
+}
+
+cycles_t
+rate_cycles(uint8_t unit)
+{
+	switch (unit) {
+	case RATE_MHZ:
+		return F_CPU / 1000000;
+	case RATE_KHZ:
+		return F_CPU / 1000;
+	case RATE_HZ:
+		return F_CPU;
+	case RATE_MILLI_HZ:
+		return (uint64_t)F_CPU * 1000;
+	}
+	return 0;
+}
+
+#if CYCLES_LOCAL_DEBUG
+#include <err.h>
+#include <stdio.h>
+
+int
+main(void)
+{
+	uint8_t unit, exact;
+	int16_t n;
+	cycles_t c, last;
+
+	/* Empty, negative and unknown */
+	for (unit = 0; unit < DUR_MAX; unit++) {
+		if (dur_cycles(0, unit, NULL) != 0 ||
+		    dur_cycles(-1, unit, NULL) != 0)
+			errx(1, "%d: unit %u", __LINE__, unit);
+	}
+	if (dur_cycles(1, DUR_MAX, &exact) != 0 || !exact)
+		errx(1, "%d: bad unit", __LINE__);
+
+	/* One of each, against the clock */
+	if (dur_cycles(1, DUR_MICROSEC, NULL) != F_CPU / 1000000 ||
+	    dur_cycles(1, DUR_MILLISEC, NULL) != F_CPU / 1000 ||
+	    dur_cycles(1, DUR_SEC, NULL) != F_CPU ||
+	    dur_cycles(1, DUR_MINUTE, NULL) != (cycles_t)F_CPU * 60 ||
+	    dur_cycles(1, DUR_HOUR, NULL) != (cycles_t)F_CPU * 3600)
+		errx(1, "%d: unit scale", __LINE__);
+
+	/* Each unit is 1000x or 60x the one before at the top of the range */
+	if (dur_cycles(1000, DUR_NANOSEC, NULL) !=
+	    dur_cycles(1, DUR_MICROSEC, NULL) ||
+	    dur_cycles(60, DUR_SEC, NULL) != dur_cycles(1, DUR_MINUTE, NULL) ||
+	    dur_cycles(60, DUR_MINUTE, NULL) != dur_cycles(1, DUR_HOUR, NULL))
+		errx(1, "%d: unit steps", __LINE__);
+
+	/* Nanoseconds round to the nearest cycle and say so */
+	if (F_CPU == 20000000) {
+		if (dur_cycles(50, DUR_NANOSEC, &exact) != 1 || !exact ||
+		    dur_cycles(24, DUR_NANOSEC, &exact) != 0 || exact ||
+		    dur_cycles(25, DUR_NANOSEC, &exact) != 1 || exact ||
+		    dur_cycles(70, DUR_NANOSEC, &exact) != 1 || exact ||
+		    dur_cycles(999, DUR_NANOSEC, &exact) != 20 || exact)
+			errx(1, "%d: nanoseconds", __LINE__);
+	}
+
+	/*
+	 * Every value of every unit: monotonic, within what the engine can
+	 * count and back to where it started if it was exact.
+	 */
+	for (unit = 0; unit < DUR_MAX; unit++) {
+		last = 0;
+		for (n = 1; n < CONFIG_VALUE_MAX; n++) {
+			c = dur_cycles(n, unit, &exact);
+			if (c < last || c > CYCLES_MAX)
+				errx(1, "%d: %d unit %u", __LINE__, n, unit);
+			if (exact && cycles_dur(c, unit) != (uint64_t)n)
+				errx(1, "%d: %d unit %u back %llu", __LINE__,
+				    n, unit, (unsigned long long)
+				    cycles_dur(c, unit));
+			last = c;
+		}
+	}
+	if (cycles_dur(1, DUR_MAX) != 0)
+		errx(1, "%d: bad unit", __LINE__);
+	/* Half a unit or more rounds up */
+	if (cycles_dur(F_CPU / 2, DUR_SEC) != 1 ||
+	    cycles_dur(F_CPU / 2 - 1, DUR_SEC) != 0 ||
+	    cycles_dur(F_CPU / 2000, DUR_MILLISEC) != 1)
+		errx(1, "%d: rounding", __LINE__);
+
+	/* The longest setting fits and old 32-bit math would have wrapped */
+	c = dur_cycles(CONFIG_VALUE_MAX - 1, DUR_HOUR, NULL);
+	if (c != (cycles_t)(CONFIG_VALUE_MAX - 1) * 3600 * F_CPU ||
+	    c <= UINT32_MAX || c > CYCLES_MAX)
+		errx(1, "%d: longest %llu", __LINE__, (unsigned long long)c);
+
+	/* Rates */
+	if (rate_cycles(RATE_MHZ) * 1000 != rate_cycles(RATE_KHZ) ||
+	    rate_cycles(RATE_KHZ) * 1000 != rate_cycles(RATE_HZ) ||
+	    rate_cycles(RATE_HZ) * 1000 != rate_cycles(RATE_MILLI_HZ) ||
+	    rate_cycles(RATE_HZ) != F_CPU || rate_cycles(RATE_MAX) != 0)
+		errx(1, "%d: rates", __LINE__);
+	if (rate_cycles(RATE_MILLI_HZ) <= UINT32_MAX)
+		errx(1, "%d: 1mHz should need more than 32 bits", __LINE__);
+
+	/* Either width of division */
+	if (cycles_div(7, 2) != 3 || cycles_div(2, 7) != 0 ||
+	    cycles_div(UINT32_MAX, 1) != UINT32_MAX ||
+	    cycles_div(3, CYCLES_MAX) != 0 ||
+	    cycles_div(CYCLES_MAX, 1ULL << 40) != 127 ||
+	    cycles_div(1ULL << 40, 3) != (1ULL << 40) / 3)
+		errx(1, "%d: division", __LINE__);
+
+	printf("OK\n");
+	return 0;
+}
+#endif /* CYCLES_LOCAL_DEBUG */
@@ -0,0 +1,67 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Conversion of configured times and rates to CPU cycles.
+ *
+ * A setting is a mantissa of [0:CONFIG_VALUE_MAX) and a unit, which
+ * spans a cycle (50ns at 20MHz) to 999 hours. That is more than 32 bits
+ * of cycles, so counts are 64 bits here. Conversion happens once, when
+ * a program is compiled; the output engine splits each delay into 16-bit
+ * timer laps and never does wide arithmetic while playing.
+ *
+ * This has no hardware dependencies so it can be tested on the build host
+ * with CYCLES_LOCAL_DEBUG.
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+
+typedef uint64_t cycles_t;
+
+/*
+ * Longest delay the output engine can count in one step, 2^47 cycles or
+ * about 1950 hours at 20MHz.
+ */
+#define CYCLES_MAX	(((cycles_t)1 << 47) - 1)
+
+/*
+ * Cycles in 'n' of duration 'unit' (DUR_*), to the nearest cycle; zero
+ * for a bad unit or n <= 0. If 'exact' isn't NULL, it's set to non-zero
+ * when no rounding was needed.
+ */
+cycles_t dur_cycles(int16_t n, uint8_t unit, uint8_t *exact);
+
+/*
+ * Cycles 'c' as a duration in 'unit', to the nearest whole unit. 'c' must
+ * be under 2^34 for the sub-second units.
+ */
+uint64_t cycles_dur(cycles_t c, uint8_t unit);
+
+/* Cycles in one period of a frequency of 1 in 'unit' (RATE_*), or 0 */
+cycles_t rate_cycles(uint8_t unit);
+
+/*
+ * a / b, in 32 bits when 'a' fits. libgcc's 64-bit division is much
+ * slower on the AVR and most settings don't need it.
+ */
+cycles_t cycles_div(cycles_t a, cycles_t b);
+
+#endif /* CYCLES_H */
@@ -15,45 +15,53 @@
  */
 
 #include <avr/io.h>
-#include <avr/interrupt.h>
-#include <util/delay.h>
 #include <util/atomic.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "accel.h"
 #include "encoder.h"
 #include "event.h"
 #include "event-types.h"
+#include "tick.h"
 
 #define ENC_MASK		((1 << ENC_PIN_A) | (1 << ENC_PIN_B))
-#define ENC_INT_MASK		((1 << ENC_INT_A) | (1 << ENC_INT_B))
 
 static int16_t enc_value;
 
-void
-encoder_setup(void)
-{
-	/* Pins -> input */
-	ENC_DDR &= ~ENC_MASK;
-	encoder_interrupt_enable();
-}
+/* Detents not yet collected by encoder_delta() */
+static int8_t enc_delta;
+static int16_t enc_scaled;	/* ... weighted by acceleration */
+static uint8_t enc_pending;	/* Set while an EV_ENCODER is queued */
+static struct accel enc_accel;
 
-void
-encoder_interrupt_enable(void)
+#define ENC_SCALED_MAX		10000
+
+/* Record a detent in direction 'dir' */
+static void
+detent(int8_t dir)
 {
-	/* Configure interrupts. XXX assumes nothing fiddles trig mode. */
-	ENC_PCMSK |= ENC_INT_MASK;
-	PCICR |= (1 << ENC_PCIE);
+	int16_t w = accel_detent(&enc_accel, tick_now(), dir);
+
+	if (enc_delta != (dir > 0 ? INT8_MAX : INT8_MIN))
+		enc_delta += dir;
+	enc_scaled += w;
+	if (enc_scaled > ENC_SCALED_MAX)
+		enc_scaled = ENC_SCALED_MAX;
+	else if (enc_scaled < -ENC_SCALED_MAX)
+		enc_scaled = -ENC_SCALED_MAX;
 }
 
 void
-encoder_interrupt_disable(void)
+encoder_setup(void)
 {
-	ENC_PCMSK &= ~ENC_INT_MASK;
-	PCICR &= ~(1 << ENC_PCIE);
+	/* Pins -> input */
+	ENC_DDR &= ~ENC_MASK;
+	accel_reset(&enc_accel);
 }
 
 void
-encoder_interrupt(void)
+encoder_sample(void)
 {
 	static uint8_t code = 0x03;
 	static int8_t decode_lut[] = {
@@ -62,33 +70,62 @@ encoder_interrupt(void)
 		-1,  0,  0,  1,
 		 0,  1, -1,  0,
 	};
-	static int pulses = 0;
+	static int8_t pulses = 0;
+	static uint8_t last = ENC_MASK;
+	uint8_t pins = ENC_PIN & ENC_MASK;
 
-	_delay_us(50); /* Allow input to settle a bit */
+	/* Most samples see no change; leave quickly */
+	if (pins == last)
+		return;
+	last = pins;
 	code = ((code << 2) & 0xf) |
-	    ((ENC_PIN & (1 << ENC_PIN_A)) ? 0x02 : 0x00) |
-	    ((ENC_PIN & (1 << ENC_PIN_B)) ? 0x01 : 0x00);
+	    ((pins & (1 << ENC_PIN_A)) ? 0x02 : 0x00) |
+	    ((pins & (1 << ENC_PIN_B)) ? 0x01 : 0x00);
 	pulses += decode_lut[code];
 
 	if (pulses >= ENC_PULSE_PER_DETENT) {
 		if (enc_value < INT16_MAX)
 			enc_value++;
-		event_enqueue(EV_ENCODER, 1, 0, 0, 0);
+		detent(1);
 		pulses = 0;
 	} else if (pulses <= -ENC_PULSE_PER_DETENT) {
 		if (enc_value > INT16_MIN)
 			enc_value--;
-		event_enqueue(EV_ENCODER, 0, 0, 0, 0);
+		detent(-1);
 		pulses = 0;
+	} else
+		return;
+	/*
+	 * Only one event is queued until the UI collects the delta, so a
+	 * fast spin can't fill the queue. If the queue is full anyway, the
+	 * delta is kept and the next detent tries again.
+	 */
+	if (!enc_pending)
+		enc_pending = event_enqueue(EV_ENCODER, enc_delta > 0,
+		    0, 0, 0);
+}
+
+int8_t
+encoder_delta(int16_t *scaled)
+{
+	int8_t r;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		r = enc_delta;
+		if (scaled != NULL)
+			*scaled = enc_scaled;
+		enc_delta = 0;
+		enc_scaled = 0;
+		enc_pending = 0;
 	}
+	return r;
 }
 
-#ifdef ENC_INTERRUPT_HANDLER
-ISR(ENC_VECT)
+void
+encoder_reset(void)
 {
-	encoder_interrupt();
+	(void)encoder_delta(NULL);
 }
-#endif
 
 int16_t
 encoder_value(void)
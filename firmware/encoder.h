@@ -22,31 +22,13 @@
 #define ENC_PORT		PORTB
 #define ENC_PIN			PINB
 #define ENC_DDR			DDRB
-#define ENC_VECT		PCINT1_vect
-#define ENC_PCIE		PCIE1
-#define ENC_PCMSK		PCMSK1
 #define ENC_PIN_A		1
 #define ENC_PIN_B		0
-#define ENC_INT_A		PCINT9
-#define ENC_INT_B		PCINT8
 #define ENC_PULSE_PER_DETENT	2
 
-/*
- * Define ENC_INTERRUPT_HANDLER if you want this module to set up the
- * interrupt handler itself. Otherwise, you need to call encoder_interrupt()
- * from a handler elsewhere.
- */
-/* #define ENC_INTERRUPT_HANDLER */
-
 /* Setup to use the rotary encoder. */
 void encoder_setup(void);
 
-/* Enable interrupts for encoder (done implicitly by encoder_setup). */
-void encoder_interrupt_enable(void);
-
-/* Disable interrupts for encoder. */
-void encoder_interrupt_disable(void);
-
 /*
  * Returns the value of the running counter incremented and decremented by
  * the encoder. It is clamped to INT16_MIN <= v <= INT16_MAX.
@@ -56,8 +38,28 @@ int16_t encoder_value(void);
 /* Sets the running counter value */
 void encoder_setvalue(int16_t v);
 
-/* The actual interrupt handler. Use only if ENC_INTERRUPT_HANDLER is unset */
-void encoder_interrupt(void);
+/*
+ * Returns the net detents turned since the last call, clamped to int8_t,
+ * and resets it. If 'scaled' is not NULL, it receives the same turn with
+ * each detent weighted by encoder acceleration (see accel.h). Detents are
+ * coalesced: at most one EV_ENCODER event is queued until this is called,
+ * so its consumer must call this.
+ */
+int8_t encoder_delta(int16_t *scaled);
+
+/*
+ * Forget any turn not yet collected. Call after event_drain(), which may
+ * have thrown away the queued EV_ENCODER that encoder_delta() would have
+ * answered; until then no further event would be queued.
+ */
+void encoder_reset(void);
+
+/*
+ * Sample and decode the encoder pins. Call from a periodic interrupt fast
+ * enough to see every quadrature state (see input.h); sampling rather
+ * than interrupting on each edge also rides over contact bounce.
+ */
+void encoder_sample(void);
 
 #endif /* ENC_H */
 
@@ -21,6 +21,8 @@
 
 /* Rotary encoder */
 #define EV_ENCODER		0x00 /* v=1 clockwise, v=0 anti-clockwise */
+				     /* net turn from encoder_delta() */
+				     /* which every consumer must call */
 /* XXX support numbered encoders */
 
 /* Pushbuttons */
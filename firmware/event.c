@@ -16,16 +16,19 @@
 
 /*
  * Define EVENT_LOCAL_DEBUG for main() that tests on build host
- * e.g. gcc -ggdb3 -o /tmp/test_event -D EVENT_LOCAL_DEBUG=1 -Wall event.c
+ * e.g. gcc -ggdb3 -o /tmp/test_event -D EVENT_LOCAL_DEBUG=1 -Wall \
+ *     -pthread event.c
+ * or "make test".
  */
 
 #ifdef EVENT_LOCAL_DEBUG
-# define ATOMIC_BLOCK(x) if (1)
+/* The test runs the producer on another thread; order stores for real */
+# define EVENT_BARRIER() __sync_synchronize()
 #else
 # include <avr/io.h>
 # include <avr/interrupt.h>
 # include <avr/sleep.h>
-# include <util/atomic.h>
+# define EVENT_BARRIER() __asm__ volatile ("" ::: "memory")
 #endif
 
 #include <stddef.h>
@@ -33,121 +36,113 @@
 
 #include "event.h"
 
-#define EVENT_QUEUE_LEN	64
+#define EVENT_QUEUE_LEN	128	/* Must be a power of two <= 128 */
+#define EVENT_MASK	(EVENT_QUEUE_LEN - 1)
 struct event {
 	uint8_t type;
 	uint8_t v[3];
 };
 
-/* Ring buffer */
+/*
+ * Single-producer/single-consumer ring buffer. Interrupt handlers are
+ * the producer and own event_head; the main loop is the consumer and
+ * owns event_tail. The indices run freely and wrap at 256, so the depth
+ * is always head - tail and a full queue is distinct from an empty one.
+ * Each side writes its slot before publishing the index, so neither
+ * needs interrupts masked: single byte loads and stores are atomic.
+ */
 static struct event events[EVENT_QUEUE_LEN];
-static unsigned int event_ptr, event_used;
-static unsigned int event_overflow, event_maxdepth;
+static volatile uint8_t event_head, event_tail;
+static volatile uint8_t event_overflow, event_maxdepth;
 
 void
 event_setup(void)
 {
 	memset(events, '\0', sizeof(events));
-	event_ptr = event_used = event_overflow = event_maxdepth = 0;
+	event_head = event_tail = event_overflow = event_maxdepth = 0;
 }
 
 void
 event_drain(void)
 {
-	event_setup();
+	event_tail = event_head;
 }
 
+/* NB. only to be called from interrupt context */
 int
 event_enqueue(uint8_t type, uint8_t v1, uint8_t v2, uint8_t v3, int important)
 {
-	int r = 0;
+	uint8_t head = event_head, used = head - event_tail;
+	struct event *e;
 
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		if (event_used >= EVENT_QUEUE_LEN) {
-			event_overflow = 1;
-			if (important)
-				event_used--;
-		}
-		if (event_used < EVENT_QUEUE_LEN) {
-			events[event_ptr].type = type;
-			events[event_ptr].v[0] = v1;
-			events[event_ptr].v[1] = v2;
-			events[event_ptr].v[2] = v3;
-			if (++event_ptr >= EVENT_QUEUE_LEN)
-				event_ptr = 0;
-			event_used++;
-			if (event_used > event_maxdepth)
-				event_maxdepth = event_used;
-			r = 1;
-		}
+	if (used >= EVENT_QUEUE_LEN) {
+		event_overflow = 1;
+		if (!important)
+			return 0;
+		/*
+		 * The consumer owns the oldest entry, so clobber the newest.
+		 * It can't be read until the queue is no longer full.
+		 */
+		head--;
+		used--;
 	}
-	return r;
+	e = &events[head & EVENT_MASK];
+	e->type = type;
+	e->v[0] = v1;
+	e->v[1] = v2;
+	e->v[2] = v3;
+	EVENT_BARRIER();
+	event_head = head + 1;
+	if (++used > event_maxdepth)
+		event_maxdepth = used;
+	return 1;
 }
 
 int
 event_dequeue(uint8_t *type, uint8_t *v1, uint8_t *v2, uint8_t *v3)
 {
-	int r = 0, o;
+	uint8_t tail = event_tail;
+	const struct event *e;
 
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		if (event_used > 0) {
-			o = (EVENT_QUEUE_LEN + event_ptr) - event_used;
-			if (o >= EVENT_QUEUE_LEN)
-				o -= EVENT_QUEUE_LEN;
-			if (type != NULL)
-				*type = events[o].type;
-			if (v1 != NULL)
-				*v1 = events[o].v[0];
-			if (v2 != NULL)
-				*v2 = events[o].v[1];
-			if (v3 != NULL)
-				*v3 = events[o].v[2];
-			event_used--;
-			r = 1;
-		}
-	}
-	return r;
+	if (event_head == tail)
+		return 0;
+	EVENT_BARRIER();
+	e = &events[tail & EVENT_MASK];
+	if (type != NULL)
+		*type = e->type;
+	if (v1 != NULL)
+		*v1 = e->v[0];
+	if (v2 != NULL)
+		*v2 = e->v[1];
+	if (v3 != NULL)
+		*v3 = e->v[2];
+	EVENT_BARRIER();
+	event_tail = tail + 1;
+	return 1;
 }
 
 int
 event_nqueued(void)
 {
-	int r;
-
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		r = event_used;
-	}
-	return r;
+	return (uint8_t)(event_head - event_tail);
 }
 
 int
 event_maxqueued(void)
 {
-	int r;
-
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		r = event_maxdepth;
-	}
-	return r;
+	return event_maxdepth;
 }
 
 int
 event_queue_overflowed(void)
 {
-	int r;
-
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		r = event_overflow;
-	}
-	return r;
+	return event_overflow;
 }
 
 void
 event_reset_overflowed(void)
 {
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		event_overflow = 0;
-	}
+	event_overflow = 0;
 }
 
 #ifndef EVENT_LOCAL_DEBUG
@@ -156,24 +151,78 @@ event_sleep(int sleep_mode, uint8_t *type,
     uint8_t *v1, uint8_t *v2, uint8_t *v3)
 {
 	set_sleep_mode(sleep_mode);
-	for (;;) {
+	while (!event_dequeue(type, v1, v2, v3)) {
+		/*
+		 * Only the final check is masked, so an event enqueued
+		 * after it must wake us. sei() takes effect after the
+		 * next instruction, so none can sneak in before the sleep.
+		 */
 		cli();
-		if (event_dequeue(type, v1, v2, v3)) {
+		if (event_head != event_tail) {
 			sei();
-			return;
+			continue;
 		}
 		sleep_enable();
 		sei();
 		sleep_cpu();
 		sleep_disable();
 	}
-	/* NOTREACHED */
 }
 #endif /* EVENT_LOCAL_DEBUG */
 
 #if EVENT_LOCAL_DEBUG
 #include <err.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+
+#define STRESS_EVENTS	2000000
+
+/*
+ * Producer for the stress test, standing in for the interrupt handlers.
+ * Enqueues a sequence number across type/v1/v2, retrying when full.
+ */
+static void *
+stress_producer(void *arg)
+{
+	uint32_t n;
+
+	for (n = 0; n < STRESS_EVENTS; n++) {
+		while (!event_enqueue(n & 0xff, (n >> 8) & 0xff, n >> 16,
+		    n % 7, 0))
+			sched_yield();
+	}
+	return NULL;
+}
+
+/* Consumer side of the stress test: every event arrives once, in order */
+static void
+stress(void)
+{
+	pthread_t producer;
+	uint32_t n, got;
+	uint8_t ev_type, ev_v1, ev_v2, ev_v3;
+
+	event_setup();
+	if (pthread_create(&producer, NULL, stress_producer, NULL) != 0)
+		errx(1, "%d: pthread_create", __LINE__);
+	for (n = 0; n < STRESS_EVENTS; n++) {
+		while (!event_dequeue(&ev_type, &ev_v1, &ev_v2, &ev_v3))
+			sched_yield();
+		got = ev_type | (ev_v1 << 8) | ((uint32_t)ev_v2 << 16);
+		if (got != (n & 0xffffff) || ev_v3 != n % 7)
+			errx(1, "%d: got %u/%u expected %u/%u", __LINE__,
+			    got, ev_v3, n & 0xffffff, n % 7);
+		if (event_nqueued() > EVENT_QUEUE_LEN)
+			errx(1, "%d: nqueued %d", __LINE__, event_nqueued());
+	}
+	pthread_join(producer, NULL);
+	if (event_nqueued() != 0)
+		errx(1, "%d: nqueued %d expected 0", __LINE__, event_nqueued());
+	if (event_maxqueued() > EVENT_QUEUE_LEN)
+		errx(1, "%d: maxqueued %d", __LINE__, event_maxqueued());
+}
+
 int
 main(void)
 {
@@ -181,7 +230,8 @@ main(void)
 	uint8_t ev_type, ev_v1, ev_v2, ev_v3;
 
 	event_setup();
-	event_ptr = 3;
+	/* Start near the top so the indices wrap */
+	event_head = event_tail = 250;
 
 	for (x = 0; x < EVENT_QUEUE_LEN; x++) {
 		if (event_enqueue(x, x, x % 3, x / 3, 0) != 1)
@@ -236,7 +286,8 @@ main(void)
 	if (event_nqueued() != EVENT_QUEUE_LEN)
 		errx(1, "%d: nqueued %d expected %d",
 		    __LINE__, event_nqueued(), EVENT_QUEUE_LEN);
-	for (x = 1; x < EVENT_QUEUE_LEN; x++) {
+	/* The important event replaced the newest one */
+	for (x = 0; x < EVENT_QUEUE_LEN - 1; x++) {
 		if (event_dequeue(&ev_type, &ev_v1, &ev_v2, &ev_v3) != 1)
 			errx(1, "%d: dequeue %d", __LINE__, x);
 		if (ev_type != x)
@@ -251,9 +302,9 @@ main(void)
 		if (ev_v3 != x / 5)
 			errx(1, "%d: v3 %d != expected %d",
 			    __LINE__, ev_v3, x << 1);
-		if (event_nqueued() != EVENT_QUEUE_LEN - x)
+		if (event_nqueued() != EVENT_QUEUE_LEN - x - 1)
 			errx(1, "%d: nqueued %d expected %d",
-			    __LINE__, event_nqueued(), x);
+			    __LINE__, event_nqueued(), EVENT_QUEUE_LEN - x - 1);
 	}
 	if (event_dequeue(&ev_type, &ev_v1, &ev_v2, &ev_v3) != 1)
 		errx(1, "%d: dequeue %d", __LINE__, x);
@@ -268,6 +319,7 @@ main(void)
 	if (event_nqueued() != 0)
 		errx(1, "%d: nqueued %d expected %d",
 		    __LINE__, event_nqueued(), 0);
+	stress();
 	printf("OK\n");
 	return 0;
 }
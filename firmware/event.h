@@ -25,14 +25,16 @@
 void event_setup(void);
 
 /*
- * Enqueue an event. Events marked as 'important' will clobber existing
- * entries on the queue rather than overflowing. Returns 1 if the event
+ * Enqueue an event. Events marked as 'important' will clobber the newest
+ * entry on the queue rather than overflowing. Returns 1 if the event
  * was successfully enqueued or 0 if an overflow prevented the queueing.
+ * NB. the queue has a single producer: call only with interrupts off,
+ * i.e. from interrupt handlers.
  */
 int event_enqueue(uint8_t type, uint8_t v1, uint8_t v2, uint8_t v3,
     int important);
 
-/* Drain all events from queue */
+/* Drain all events from queue; main loop only */
 void event_drain(void);
 
 /*
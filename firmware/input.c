@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <avr/io.h>
+#include <stdint.h>
+
+#include "encoder.h"
+#include "event.h"
+#include "event-types.h"
+#include "input.h"
+
+struct button {
+	uint8_t pin;		/* Bit in INPUT_PIN */
+	uint8_t state;		/* Debounced level */
+	uint8_t count;		/* Samples seen at the other level */
+};
+
+static struct button buttons[2] = {
+	{ INPUT_PIN_ENC_BUTTON, 1, 0 },
+	{ INPUT_PIN_BUTTON, 0, 0 },
+};
+
+void
+input_sample(void)
+{
+	uint8_t i, level, pins = INPUT_PIN;
+	struct button *b;
+
+	encoder_sample();
+	for (i = 0; i < 2; i++) {
+		b = &buttons[i];
+		level = (pins >> b->pin) & 1;
+		if (level == b->state) {
+			b->count = 0;
+			continue;
+		}
+		if (++b->count < INPUT_DEBOUNCE_SAMPLES)
+			continue;
+		b->state = level;
+		b->count = 0;
+		/* NB. encoder button is active-low */
+		event_enqueue(EV_BUTTON, i, i == 0 ? !level : level, 0, 0);
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Front panel inputs: the encoder and the two pushbuttons are sampled
+ * from the system tick rather than from pin change interrupts, so no
+ * interrupt handler waits for contacts to settle.
+ *
+ * Button events are EV_BUTTON with v1 = 0 for the encoder button (v2 set
+ * when pressed) and v1 = 1 for the other button (v2 = its pin level).
+ */
+
+#include <stdint.h>
+
+#define INPUT_PORT		PORTB
+#define INPUT_PIN		PINB
+#define INPUT_PIN_ENC_BUTTON	2
+#define INPUT_PIN_BUTTON	3
+
+/*
+ * A button changes state after this many consecutive samples at the new
+ * level, i.e. 2ms at the tick's sample rate.
+ */
+#define INPUT_DEBOUNCE_SAMPLES	8
+
+/* Called from the tick interrupt at TICK_SAMPLE_HZ */
+void input_sample(void);
+
+#endif /* INPUT_H */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Cost of the front panel input sampling, for "make isr-bench". Each
+ * case is one pulse on PA0 around a call, timed by wait_bench_sim -p:
+ *
+ *	0	old pin change handler body: settle delay + decode
+ *	1	input_sample(), nothing changed
+ *	2	input_sample(), encoder pulse
+ *	3	input_sample(), encoder detent (queues an event)
+ *	4	input_sample(), button change accepted after debounce
+ *
+ * The tick interrupt adds its prologue and epilogue (~30 cycles) to the
+ * input_sample() cases. The pins are driven as outputs to simulate input.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include <stdint.h>
+
+#include "encoder.h"
+#include "event.h"
+#include "input.h"
+#include "wait_bench.h"
+
+#define PULSE(x) do { \
+	PORTA = (1 << WAIT_BENCH_PIN); \
+	x; \
+	PORTA = 0; \
+} while (0)
+
+int
+main(void)
+{
+	uint8_t i;
+
+	cli();
+	DDRA = (1 << WAIT_BENCH_PIN);
+	PORTA = 0;
+	event_setup();
+	encoder_setup();
+	/* Encoder and buttons idle high */
+	PORTB = 0x0f;
+	DDRB = 0x0f;
+
+	/* Pulse widths include a call and the port writes */
+	PULSE(_delay_us(50); encoder_sample());
+
+	PULSE(input_sample());
+
+	PORTB &= ~(1 << ENC_PIN_A);
+	PULSE(input_sample());
+
+	PORTB &= ~(1 << ENC_PIN_B);
+	PULSE(input_sample());
+
+	PORTB &= ~(1 << INPUT_PIN_BUTTON);
+	for (i = 0; i < INPUT_DEBOUNCE_SAMPLES - 1; i++)
+		input_sample();
+	PULSE(input_sample());
+
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_enable();
+	sleep_cpu();
+	for (;;)
+		;
+}
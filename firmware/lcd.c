@@ -18,10 +18,11 @@
 #error Must define F_CPU on commandline
 #endif
 
-/* XXX maintain location pointer to avoid getpos() calls */
-
 #include <stddef.h>
+#include <string.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
 #include <util/delay_basic.h>
 
@@ -51,6 +52,36 @@ static const uint8_t row_addrs[LCD_ROWS] = { 0x00 };
 # error Unsupported LCD_ROWS
 #endif
 
+#define LCD_ADDR_UNKNOWN	0xff
+
+/*
+ * Shadow of the display. Text is drawn into 'shadow' at a software
+ * cursor; lcd_flush() sends the cells that differ from 'shown', which
+ * mirrors the LCD's DDRAM, and tracks the LCD's address counter so that
+ * a run of changed cells costs one address set.
+ */
+static char shadow[LCD_ROWS][LCD_COLS];
+static char shown[LCD_ROWS][LCD_COLS];
+static uint8_t cur_x, cur_y;		/* cur_x == LCD_COLS past the end */
+static uint8_t hw_addr = LCD_ADDR_UNKNOWN;
+
+/*
+ * Write queue. Once the LCD is set up, commands and characters are queued
+ * here and written one per Timer0 compare interrupt, spaced further apart
+ * than the LCD takes to execute them, so nothing waits on the busy flag.
+ * Single producer (main loop), single consumer (the interrupt).
+ */
+#define LCD_QUEUE_LEN		128	/* Power of two */
+#define LCD_QUEUE_MASK		(LCD_QUEUE_LEN - 1)
+struct lcd_op {
+	uint8_t rs;
+	uint8_t val;
+};
+static struct lcd_op lcdq[LCD_QUEUE_LEN];
+static volatile uint8_t lcdq_head, lcdq_tail;
+static uint8_t queueing;
+static int (*quiet_hook)(void);
+
 #define LCD_NUM_CG_CHARS	8
 #define LCD_CG_MASK		0x1f
 
@@ -85,6 +116,59 @@ static const uint8_t row_addrs[LCD_ROWS] = { 0x00 };
 #define LCD_R_BUSY		0x80
 #define LCD_R_ADDR_MASK		0x7f
 
+/*
+ * The DB4..DB7 lines needn't be in order on the port, so nibbles are
+ * mapped to port bits and back through tables rather than a bit test
+ * per line. Reading needs the DB pins to fall within a 4-bit window of
+ * the port.
+ */
+#define NIB_PORT(n)	((((n) & 0x1) ? 1 << LCD_DB_4 : 0) | \
+			 (((n) & 0x2) ? 1 << LCD_DB_5 : 0) | \
+			 (((n) & 0x4) ? 1 << LCD_DB_6 : 0) | \
+			 (((n) & 0x8) ? 1 << LCD_DB_7 : 0))
+static const uint8_t nib_to_port[16] = {
+	NIB_PORT(0), NIB_PORT(1), NIB_PORT(2), NIB_PORT(3),
+	NIB_PORT(4), NIB_PORT(5), NIB_PORT(6), NIB_PORT(7),
+	NIB_PORT(8), NIB_PORT(9), NIB_PORT(10), NIB_PORT(11),
+	NIB_PORT(12), NIB_PORT(13), NIB_PORT(14), NIB_PORT(15),
+};
+
+#ifndef LCD_WRITE_ONLY
+#define MIN2(a, b)	((a) < (b) ? (a) : (b))
+#define LCD_DB_SHIFT	MIN2(MIN2(LCD_DB_4, LCD_DB_5), MIN2(LCD_DB_6, LCD_DB_7))
+#if (LCD_DB_MASK >> LCD_DB_SHIFT) > 0xf
+# error LCD DB pins must be within four adjacent bits for reading
+#endif
+#define PORT_BIT(p, db)	(((p) << LCD_DB_SHIFT) & (1 << (db)))
+#define PORT_NIB(p)	((PORT_BIT(p, LCD_DB_4) ? 0x1 : 0) | \
+			 (PORT_BIT(p, LCD_DB_5) ? 0x2 : 0) | \
+			 (PORT_BIT(p, LCD_DB_6) ? 0x4 : 0) | \
+			 (PORT_BIT(p, LCD_DB_7) ? 0x8 : 0))
+static const uint8_t port_to_nib[16] = {
+	PORT_NIB(0), PORT_NIB(1), PORT_NIB(2), PORT_NIB(3),
+	PORT_NIB(4), PORT_NIB(5), PORT_NIB(6), PORT_NIB(7),
+	PORT_NIB(8), PORT_NIB(9), PORT_NIB(10), PORT_NIB(11),
+	PORT_NIB(12), PORT_NIB(13), PORT_NIB(14), PORT_NIB(15),
+};
+#define PIN_NIB(p)	port_to_nib[((p) & LCD_DB_MASK) >> LCD_DB_SHIFT]
+#endif /* LCD_WRITE_ONLY */
+
+/*
+ * Clock a nibble out on the DB lines. The DB pins are left as outputs
+ * between writes; only lcd_read8() turns them around.
+ */
+static inline void
+lcd_nibble(uint8_t nib)
+{
+	/* Assert 'enable', send data and hold */
+	LCD_EN_PORT |= (1 << LCD_EN);
+	LCD_DB_PORT = (LCD_DB_PORT & ~LCD_DB_MASK) | nib_to_port[nib];
+	_delay_us(0.250); /* Tpw = 230ns */
+	/* Drop 'enable' while holding data for a period */
+	LCD_EN_PORT &= ~(1 << LCD_EN);
+	_delay_us(0.050); /* Thd2 = 10ns */
+}
+
 /*
  * Write a nibble to the LCD card; used for early setup to put it in
  * 4-wire mode.
@@ -92,84 +176,44 @@ static const uint8_t row_addrs[LCD_ROWS] = { 0x00 };
 static void
 lcd_write4(int rs, uint8_t val)
 {
-	/* We'll be using the DB pins as outputs here */
-	LCD_DB_DDR |= LCD_DB_MASK;
-	/* Select register and R/W mode */
+	/* Select register; R/W stays low */
 	LCD_CTL_PORT = (LCD_CTL_PORT & ~LCD_CTL_MASK) |
 	    (rs ? 1 << LCD_CTL_RS : 0);
 	_delay_us(0.100); /* Tsp1 = 40ns */
-	/* Assert 'enable', send data and hold */
-	LCD_EN_PORT |= (1 << LCD_EN);
-	LCD_DB_PORT = (LCD_DB_PORT & ~LCD_DB_MASK) |
-		((val & 0x1) ? 1 << LCD_DB_4 : 0) |
-		((val & 0x2) ? 1 << LCD_DB_5 : 0) |
-		((val & 0x4) ? 1 << LCD_DB_6 : 0) |
-		((val & 0x8) ? 1 << LCD_DB_7 : 0);
-	_delay_us(0.250); /* Tpw = 230ns */
-	/* Drop 'enable' while holding data for a period */
-	LCD_EN_PORT &= ~(1 << LCD_EN);
-	_delay_us(0.050); /* Thd2 = 10ns */
-	/* De-assert all signals, float DB lines */
-	LCD_CTL_PORT &= ~LCD_CTL_MASK;
-	LCD_DB_PORT |= LCD_DB_MASK;
-	/* Put DB pins back to HiZ input mode */
-	LCD_DB_DDR &= ~LCD_DB_MASK;
+	lcd_nibble(val & 0xf);
 	/* Ensure Tc=500ns is satisfied too */
 	_delay_us(0.250); /* In addition to Tpw delay above */
 }
 
-/* Write a byte to the LCD card */
+/*
+ * Write a byte to the LCD card. About 45 cycles at 20MHz, most of which
+ * are the bus timing delays; "make lcd-bench" measures it.
+ */
 static void
 lcd_write8(int rs, uint8_t val)
 {
-	/* We'll be using the DB pins as outputs here */
-	LCD_DB_DDR |= LCD_DB_MASK;
-	/* Select register and R/W mode */
+	/* Select register; R/W stays low */
 	LCD_CTL_PORT = (LCD_CTL_PORT & ~LCD_CTL_MASK) |
 	    (rs ? 1 << LCD_CTL_RS : 0);
 	_delay_us(0.100); /* Tsp1 = 40ns */
-	/* Assert 'enable', send data MSB and hold */
-	LCD_EN_PORT |= (1 << LCD_EN);
-	LCD_DB_PORT = (LCD_DB_PORT & ~LCD_DB_MASK) |
-		((val & 0x10) ? 1 << LCD_DB_4 : 0) |
-		((val & 0x20) ? 1 << LCD_DB_5 : 0) |
-		((val & 0x40) ? 1 << LCD_DB_6 : 0) |
-		((val & 0x80) ? 1 << LCD_DB_7 : 0);
-	_delay_us(0.250); /* Tpw = 230ns */
-	/* Drop 'enable' while holding data for a period */
-	LCD_EN_PORT &= ~(1 << LCD_EN);
-	_delay_us(0.050); /* Thd2 = 10ns */
-	/* Reassert 'enable' and send data LSB */
-	LCD_EN_PORT |= (1 << LCD_EN);
-	LCD_DB_PORT = (LCD_DB_PORT & ~LCD_DB_MASK) |
-		((val & 0x01) ? 1 << LCD_DB_4 : 0) |
-		((val & 0x02) ? 1 << LCD_DB_5 : 0) |
-		((val & 0x04) ? 1 << LCD_DB_6 : 0) |
-		((val & 0x08) ? 1 << LCD_DB_7 : 0);
-	_delay_us(0.250); /* Tpw = 230ns */
-	/* Drop 'enable' while holding data for a period */
-	LCD_EN_PORT &= ~(1 << LCD_EN);
-	_delay_us(0.050); /* Thd2 = 10ns */
-	/* De-assert all signals, float DB lines */
-	LCD_CTL_PORT &= ~LCD_CTL_MASK;
-	LCD_DB_PORT |= LCD_DB_MASK;
-	/* Put DB pins back to HiZ input mode */
-	LCD_DB_DDR &= ~LCD_DB_MASK;
+	lcd_nibble(val >> 4);
+	lcd_nibble(val & 0xf);
 	/* Ensure Tc=500ns is satisfied too */
 	_delay_us(0.250); /* In addition to Tpw delay above */
 }
 
+#ifndef LCD_WRITE_ONLY
 /* Read a byte from the LCD card */
 static uint8_t
 lcd_read8(int rs)
 {
 	uint8_t pin_h, pin_l;
 
+	/* We'll be using the DB pins as inputs here */
+	LCD_DB_DDR &= ~LCD_DB_MASK;
 	/* Select register and R/W mode */
 	LCD_CTL_PORT = (LCD_CTL_PORT & ~LCD_CTL_MASK) |
 	    (rs ? (1 << LCD_CTL_RS) : 0) | (1 << LCD_CTL_RW);
-	/* We'll be using the DB pins as inputs here */
-	LCD_DB_DDR &= ~LCD_DB_MASK;
 	_delay_us(0.100); /* Tsp1 = 40ns */
 	/* Assert 'enable' and hold for data */
 	LCD_EN_PORT |= (1 << LCD_EN);
@@ -184,57 +228,122 @@ lcd_read8(int rs)
 	/* Drop 'enable' */
 	LCD_EN_PORT &= ~(1 << LCD_EN);
 	_delay_us(0.050); /* Thd1 = 10ns */
-	/* De-assert all signals, float DB lines */
+	/* Back to writing; the LCD lets go of DB once R/W drops */
 	LCD_CTL_PORT &= ~LCD_CTL_MASK;
-	LCD_DB_PORT |= LCD_DB_MASK;
-	return ((pin_l & (1 << LCD_DB_4)) ? 0x01 : 0) |
-	    ((pin_l & (1 << LCD_DB_5)) ? 0x02 : 0) |
-	    ((pin_l & (1 << LCD_DB_6)) ? 0x04 : 0) |
-	    ((pin_l & (1 << LCD_DB_7)) ? 0x08 : 0) |
-	    ((pin_h & (1 << LCD_DB_4)) ? 0x10 : 0) |
-	    ((pin_h & (1 << LCD_DB_5)) ? 0x20 : 0) |
-	    ((pin_h & (1 << LCD_DB_6)) ? 0x40 : 0) |
-	    ((pin_h & (1 << LCD_DB_7)) ? 0x80 : 0);
+	LCD_DB_DDR |= LCD_DB_MASK;
+	return (PIN_NIB(pin_h) << 4) | PIN_NIB(pin_l);
 }
 
-/* Wait until the LCD card's busy flag is clear; return the current address */
-static uint8_t
+/*
+ * Wait until the LCD card's busy flag is clear. The driver tracks the
+ * address counter itself (see lcd_flush()), so the address that comes
+ * with the flag is never needed.
+ */
+static void
 lcd_waitbusy(void)
 {
 	while ((lcd_read8(0) & LCD_R_BUSY) != 0)
 		;
-	
-	_delay_us(1);
-	return lcd_read8(0) & LCD_R_ADDR_MASK;
 }
 
 /* Issue a command to the LCD driver */
 static void
 lcd_command(int rs, uint8_t val)
 {
-	(void)lcd_waitbusy();
+	lcd_waitbusy();
+	lcd_write8(rs, val);
+}
+#else /* LCD_WRITE_ONLY */
+/* Without reads, wait out the worst case for the previous command */
+static void
+lcd_waitbusy(void)
+{
+	_delay_us(LCD_EXEC_US);
+}
+
+/* Issue a command to the LCD driver */
+static void
+lcd_command(int rs, uint8_t val)
+{
+	lcd_waitbusy();
 	lcd_write8(rs, val);
+	/* Clear and return take far longer than anything else */
+	if (rs == 0 && (val == LCD_C_CLEAR || (val & ~1) == LCD_C_RETURN))
+		_delay_us(LCD_SLOW_US);
+}
+#endif /* LCD_WRITE_ONLY */
+
+ISR(TIMER0_COMPA_vect)
+{
+	uint8_t t = lcdq_tail;
+
+	if (t == lcdq_head) {
+		/* Idle until more is queued */
+		TIMSK0 &= ~(1 << OCIE0A);
+		return;
+	}
+	/* Don't hold up anything more urgent; try again next time */
+	if (quiet_hook != NULL && !quiet_hook())
+		return;
+	lcd_write8(lcdq[t & LCD_QUEUE_MASK].rs, lcdq[t & LCD_QUEUE_MASK].val);
+	__asm__ volatile ("" ::: "memory");
+	lcdq_tail = t + 1;
+}
+
+/* Queue a command or character, waiting only if the queue is full */
+static void
+lcd_queue(int rs, uint8_t val)
+{
+	uint8_t h = lcdq_head;
+	struct lcd_op *op;
+
+	if (!queueing) {
+		lcd_command(rs, val);
+		return;
+	}
+	while ((uint8_t)(h - lcdq_tail) >= LCD_QUEUE_LEN)
+		;
+	op = &lcdq[h & LCD_QUEUE_MASK];
+	op->rs = rs;
+	op->val = val;
+	__asm__ volatile ("" ::: "memory");
+	lcdq_head = h + 1;
+	TIMSK0 |= (1 << OCIE0A);
+}
+
+void
+lcd_sync(void)
+{
+	while (lcdq_head != lcdq_tail)
+		;
 }
 
 void
 lcd_home(void)
 {
-	lcd_command(0, LCD_C_RETURN);
+	cur_x = cur_y = 0;
 }
 
 void
 lcd_display(int display_on, int cursor_on, int blink_on)
 {
-	lcd_command(0, LCD_C_DISPLAY_ON_OFF |
+	static uint8_t last = 0xff;
+	uint8_t cmd = LCD_C_DISPLAY_ON_OFF |
 	    (display_on ? LCD_O_DISPLAY_ON : 0) |
 	    (cursor_on ? LCD_O_DISPLAY_CURSOR : 0) |
-	    (blink_on ? LCD_O_DISPLAY_BLINK : 0));
+	    (blink_on ? LCD_O_DISPLAY_BLINK : 0);
+
+	/* The UI sets this on every redraw; skip it when unchanged */
+	if (cmd == last)
+		return;
+	lcd_queue(0, cmd);
+	last = cmd;
 }
 
 void
 lcd_entry_mode(int rtl, int shift)
 {
-	lcd_command(0, LCD_C_ENTRY_MODE |
+	lcd_queue(0, LCD_C_ENTRY_MODE |
 	    (rtl ? 0 : LCD_O_ENTRY_LTR) |
 	    (shift ? LCD_O_ENTRY_SHIFT : 0));
 }
@@ -243,136 +352,139 @@ lcd_entry_mode(int rtl, int shift)
 void
 lcd_clear(void)
 {
-	lcd_command(0, LCD_C_CLEAR);
+	memset(shadow, ' ', sizeof(shadow));
+	cur_x = cur_y = 0;
 }
 
 /* Clear to the end of the current line only */
 void
 lcd_clear_eol(void)
 {
-	int x, i;
-
-	lcd_getpos(&x, NULL);
-	for (i = LCD_COLS - x; i > 0; i--)
-		lcd_command(1, ' ');
+	lcd_fill(' ', LCD_COLS - cur_x);
 }
 
-/* Write a string to the LCD without bounds-checking */
+/* Write characters at the cursor, truncating at the end of the line */
 static void
-lcd_write_string_raw(const char *s, int len)
+lcd_put(const char *s, size_t len)
 {
-	while (*s != '\0' && (len == -1 || len-- > 0))
-		lcd_command(1, *s++);
+	while (len-- > 0 && cur_x < LCD_COLS)
+		shadow[cur_y][cur_x++] = *s++;
 }
 
-/* Display an error message */
+/* Display an error message from flash */
 static void
 lcd_error(const char *s)
 {
 	lcd_clear();
-	lcd_home();
-	lcd_write_string_raw("XXXXXXXXXXXXXXXXXXXX", 20);
-	lcd_command(0, LCD_C_SET_DDRAM_ADDR | row_addrs[(LCD_ROWS - 1)]);
-	lcd_write_string_raw(s, 20);
+	lcd_fill('X', LCD_COLS);
+	lcd_moveto(0, LCD_ROWS - 1);
+	lcd_string_P(s);
 	lcd_home();
 }
 
 void
 lcd_moveto(int x, int y)
 {
-	if (x >= LCD_COLS || y >= LCD_ROWS) {
-		lcd_error("lcd moveto error");
+	if (x < 0 || y < 0 || x >= LCD_COLS || y >= LCD_ROWS) {
+		lcd_error(PSTR("lcd moveto error"));
 		return;
 	}
-	lcd_command(0, LCD_C_SET_DDRAM_ADDR | (row_addrs[y] + x));
+	cur_x = x;
+	cur_y = y;
 }
 
 void
 lcd_getpos(int *x, int *y)
 {
-	uint8_t i, xx, yy, addr = lcd_waitbusy();
-
-	xx = yy = 0xff;
-	for (i = 0; i < LCD_ROWS; i++) {
-		if (addr >= row_addrs[i] && addr < (row_addrs[i] + LCD_COLS)) {
-			xx = addr - row_addrs[i];
-			yy = i;
-			break;
-		}
-	}
-	if (xx >= LCD_COLS || yy >= LCD_ROWS) {
-		/* wtf? */
-		*x = *y = 0;
-		lcd_error("bad lcd address");
-	} else {
-		if (x != NULL)
-			*x = xx;
-		if (y != NULL)
-			*y = yy;
-	}
+	if (x != NULL)
+		*x = cur_x;
+	if (y != NULL)
+		*y = cur_y;
 }
 
 void
 lcd_string(const char *s)
 {
-	int x;
+	lcd_put(s, strlen(s));
+}
+
+void
+lcd_string_P(const char *s)
+{
+	char c;
 
-	lcd_getpos(&x, NULL);
-	if (x >= LCD_COLS)
-		return; /* Shouldn't happen */
-	lcd_write_string_raw(s, LCD_COLS - x);
+	while ((c = pgm_read_byte(s++)) != '\0' && cur_x < LCD_COLS)
+		shadow[cur_y][cur_x++] = c;
 }
 
 void
 lcd_chars(const char *s, size_t len)
 {
-	int x;
-
-	lcd_getpos(&x, NULL);
-	if (x >= LCD_COLS)
-		return; /* Shouldn't happen */
-	if ((len + x) >= LCD_COLS)
-		len = LCD_COLS - x;
-	for (; len > 0; len--)
-		lcd_command(1, *s++);
+	lcd_put(s, len);
 }
 
 void
 lcd_char(char c)
 {
-	int x;
-
-	lcd_getpos(&x, NULL);
-	if (x >= LCD_COLS)
-		return;
-	lcd_command(1, c);
+	lcd_put(&c, 1);
 }
 
 void
 lcd_fill(char c, size_t n)
 {
-	int x;
+	while (n-- > 0 && cur_x < LCD_COLS)
+		shadow[cur_y][cur_x++] = c;
+}
 
-	lcd_getpos(&x, NULL);
-	if (x >= LCD_COLS)
-		return;
-	if ((n + x) >= LCD_COLS)
-		n = LCD_COLS - x;
-	while (n-- > 0)
-		lcd_command(1, c);
+/* Write a character at the LCD's address counter, tracking the counter */
+static void
+lcd_send(uint8_t addr, char c)
+{
+	if (addr != hw_addr)
+		lcd_queue(0, LCD_C_SET_DDRAM_ADDR | addr);
+	lcd_queue(1, c);
+	hw_addr = addr + 1;
+}
+
+void
+lcd_flush(void)
+{
+	uint8_t x, y, addr;
+
+	for (y = 0; y < LCD_ROWS; y++) {
+		for (x = 0; x < LCD_COLS; x++) {
+			if (shadow[y][x] == shown[y][x])
+				continue;
+			lcd_send(row_addrs[y] + x, shadow[y][x]);
+			shown[y][x] = shadow[y][x];
+		}
+	}
+	/* Leave the LCD's cursor at ours */
+	addr = row_addrs[cur_y] + (cur_x < LCD_COLS ? cur_x : LCD_COLS - 1);
+	if (addr != hw_addr) {
+		lcd_queue(0, LCD_C_SET_DDRAM_ADDR | addr);
+		hw_addr = addr;
+	}
 }
 
 void
 lcd_program_char(int c, uint8_t *data, size_t len)
 {
 	if (c > LCD_NUM_CG_CHARS || len != 8) {
-		lcd_error("bad character data");
+		lcd_error(PSTR("bad character data"));
 		return;
 	}
-	lcd_command(0, LCD_C_SET_CGRAM_ADDR | (c * 8));
+	lcd_queue(0, LCD_C_SET_CGRAM_ADDR | (c * 8));
 	for (; len > 0; len--)
-		lcd_command(1, *data++);
-	lcd_home(); /* back to display memory */
+		lcd_queue(1, *data++);
+	/* Back to display memory on the next flush */
+	hw_addr = LCD_ADDR_UNKNOWN;
+}
+
+void
+lcd_set_quiet(int (*quiet)(void))
+{
+	quiet_hook = quiet;
 }
 
 void
@@ -399,11 +511,22 @@ lcd_setup(void)
 	    LCD_O_FUNC_FONT_5X8);
 	/* Display off */
 	lcd_display(0, 0, 0);
+	lcd_command(0, LCD_C_CLEAR);
+	memset(shown, ' ', sizeof(shown));
 	lcd_clear();
 	/* Entry mode: advance and scroll XXX */
 	lcd_entry_mode(0, 0);
-	lcd_home();
+	lcd_command(0, LCD_C_RETURN);
+	hw_addr = 0;
 	/* Display enable, cursor off, blink off */
 	lcd_display(1, 0, 0);
+	lcd_waitbusy();
+
+	/* From here on, writes go through the queue */
+	lcdq_head = lcdq_tail = 0;
+	TCCR0A = (1 << WGM01); /* CTC */
+	TCCR0B = (1 << CS01) | (1 << CS00); /* clk/64 */
+	OCR0A = (F_CPU / 64 * LCD_QUEUE_US / 1000000UL) - 1;
+	queueing = 1;
 }
 
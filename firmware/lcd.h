@@ -17,7 +17,16 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-/* Driver for a HD44870-style 20x2 LCD */
+/*
+ * Driver for a HD44870-style 20x2 LCD
+ *
+ * Text is drawn into a RAM shadow of the display and only reaches the LCD
+ * on lcd_flush(), which sends just the cells that changed. Text functions
+ * assume the default left-to-right entry mode.
+ *
+ * After lcd_setup(), everything sent to the LCD is queued and written from
+ * the Timer0 compare interrupt, so no call waits on the LCD.
+ */
 
 #define LCD_ROWS	4
 #define LCD_COLS	20
@@ -43,6 +52,21 @@
 #define LCD_DB_6	1
 #define LCD_DB_7	0
 
+/*
+ * Define LCD_WRITE_ONLY if R/W is tied low or the LCD shouldn't be read.
+ * The busy flag is then never polled; each command instead waits out
+ * LCD_EXEC_US, or LCD_SLOW_US after a clear or return.
+ */
+/* #define LCD_WRITE_ONLY */
+#define LCD_EXEC_US	50	/* 37us at the nominal 270kHz LCD clock */
+#define LCD_SLOW_US	2000	/* 1.52ms at 270kHz */
+
+/*
+ * The queue is drained one write per LCD_QUEUE_US, longer than the 37us
+ * a HD44780 takes for each.
+ */
+#define LCD_QUEUE_US		64
+
 /* LCD special characters */
 #define LCD_CHAR_ARROW_R	0x7e
 #define LCD_CHAR_ARROW_L	0x7f
@@ -88,6 +112,13 @@
  */
 void lcd_setup(void);
 
+/*
+ * Set a function that says whether the queue's interrupt may use the bus
+ * now, e.g. not when something more urgent is due. NULL means always.
+ * Set it before lcd_setup().
+ */
+void lcd_set_quiet(int (*quiet)(void));
+
 /* Turn the display, cursor and cursor blinking off or on */
 void lcd_display(int display_on, int cursor_on, int blink_on);
 
@@ -99,6 +130,15 @@ void lcd_display(int display_on, int cursor_on, int blink_on);
  */
 void lcd_entry_mode(int rtl, int shift);
 
+/*
+ * Send the changes drawn since the last flush to the LCD and move its
+ * cursor to the drawing position.
+ */
+void lcd_flush(void);
+
+/* Wait until everything queued has been written to the LCD */
+void lcd_sync(void);
+
 /* Clear the screen */
 void lcd_clear(void);
 
@@ -123,6 +163,9 @@ void lcd_getpos(int *x, int *y);
  */
 void lcd_string(const char *s);
 
+/* As lcd_string(), for a string in flash, e.g. from PSTR() */
+void lcd_string_P(const char *s);
+
 /*
  * Write an array of characters to the screen. Useful for writing the
  * \0 custom character.
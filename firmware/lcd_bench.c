@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * LCD driver throughput, for "make lcd-bench". Each case is one pulse on
+ * PA0 timed by wait_bench_sim -p; characters/sec = F_CPU * chars / cycles.
+ *
+ *	0	20 characters the old way: a busy flag and address read for
+ *		lcd_getpos(), then for each character a busy flag read, the
+ *		1us settle, an address read and the write
+ *	1	20 characters drawn and flushed through the shadow
+ *	2	redraw of the same 20 characters; nothing is sent
+ *	3	one changed character in a row of 20
+ *	4	20 bytes through lcd_write8(); cycles per byte = width / 20
+ *	5	20 commands through lcd_command(): a busy flag read and a
+ *		write each, or a write and LCD_EXEC_US when LCD_WRITE_ONLY
+ *
+ * Cases 1-3 measure what the caller waits for: drawing and queueing. The
+ * queue is written from the Timer0 interrupt, one write per LCD_QUEUE_US.
+ * The harness grounds DB7 so the busy flag always reads clear; only the
+ * driver's own bus cost is measured, not the LCD's execution time.
+ *
+ * lcd_bench_wo.elf is the same built with LCD_WRITE_ONLY. Case 0 needs
+ * reads, so it's an empty pulse there.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include <stdint.h>
+
+/* Built with the driver so the old path can use its internals */
+#include "lcd.c"
+#include "wait_bench.h"
+
+#define PULSE(x) do { \
+	PORTA = (1 << WAIT_BENCH_PIN); \
+	x; \
+	PORTA = 0; \
+} while (0)
+
+#define BENCH_TEXT	"0123456789abcdefghij"
+
+#ifndef LCD_WRITE_ONLY
+/* lcd_waitbusy() as it was when it also returned the address */
+static uint8_t
+old_waitbusy(void)
+{
+	while ((lcd_read8(0) & LCD_R_BUSY) != 0)
+		;
+	_delay_us(1);
+	return lcd_read8(0) & LCD_R_ADDR_MASK;
+}
+
+static void
+old_string(const char *s)
+{
+	(void)old_waitbusy();
+	while (*s != '\0') {
+		(void)old_waitbusy();
+		lcd_write8(1, *s++);
+	}
+}
+#else
+#define old_string(s)
+#endif
+
+static void
+new_string(const char *s)
+{
+	lcd_moveto(0, 0);
+	lcd_string(s);
+	lcd_flush();
+}
+
+static void
+bytes(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < 20; i++)
+		lcd_write8(1, 'x');
+}
+
+static void
+commands(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < 20; i++)
+		lcd_command(1, 'x');
+}
+
+int
+main(void)
+{
+	cli();
+	DDRA = (1 << WAIT_BENCH_PIN);
+	PORTA = 0;
+	lcd_setup();
+
+	PULSE(old_string(BENCH_TEXT));
+	PULSE(new_string(BENCH_TEXT));
+	PULSE(new_string(BENCH_TEXT));
+	PULSE(new_string("0123456789Xbcdefghij"));
+	/* Interrupts are off, so the queue isn't drained under these */
+	PULSE(bytes());
+	PULSE(commands());
+
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_enable();
+	sleep_cpu();
+	for (;;)
+		;
+}
@@ -16,6 +16,7 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <avr/sleep.h>
 #include <util/delay.h>
 #include <stddef.h>
@@ -28,113 +29,118 @@
 #include "event.h"
 #include "event-types.h"
 #include "ui.h"
+#include "wait.h"
+#include "output.h"
+#include "schedule.h"
+#include "trigger.h"
+#include "tick.h"
+#include "persist.h"
+
+#ifdef BOOT_BENCH
+/*
+ * Mark startup milestones on PA0 for "make boot-bench", which reports
+ * when each starts and how long it took.
+ */
+# define BOOT_MARK(x) do { \
+	PORTA |= (1 << 0); \
+	x; \
+	PORTA &= ~(1 << 0); \
+} while (0)
+#else
+# define BOOT_MARK(x) x
+#endif
 
-static int pb_encoder = 1;
-static int pb_button = 0;
-static int running = 0;
-
-/* Interrupt for the digitial inputs */
-ISR(PCINT0_vect)
-{
-	/* Nothing here - we just need an interrupt to leave sleep. */
-}
-
-/* Interrupt for pushbuttons and the rotaty encoder */
-ISR(PCINT1_vect)
+#ifdef RETRIGGER_BENCH
+/*
+ * "make retrigger-bench" builds this once per mode below and runs it in
+ * wait_bench_sim, which pulses the trigger input faster and faster to
+ * find the quickest rate at which every trigger still fires. The editor
+ * is skipped and the shortest program for the mode is armed on channel 2
+ * (PA0), so the rate is set by the run loop rather than the program.
+ * A pulse on PA0 before the first arm tells the harness to start.
+ * "make latency-bench" reuses modes 0 and 1 to time the first edge.
+ *
+ *	0	oneshot, level trigger on input 1, no holdoff
+ *	1	oneshot, edge trigger on input 1, no holdoff
+ *	2	strobe of one pulse, manual button trigger
+ */
+static void
+bench_config(void)
 {
-	int pb;
-
-	if (running)
-		return; /* no events */
-
-	encoder_interrupt();
-	pb = (PINB >> 2) & 1;
-	if (pb != pb_encoder) {
-		/* NB. encoder button is active-low */
-		event_enqueue(EV_BUTTON, 0, !pb, 0, 0);
-		pb_encoder = pb;
-	}
-	pb = (PINB >> 3) & 1;
-	if (pb != pb_button) {
-		event_enqueue(EV_BUTTON, 1, pb, 0, 0);
-		pb_button = pb;
-	}
+	reset_config();
+	cfg.output = OUT_CH2;
+	cfg.mode = MODE_ONESHOT;
+	cfg.trigger[0] = TRIG_CHAN_1;
+	cfg.wait = 0;
+	cfg.on = 1;
+	cfg.on_unit = DUR_MICROSEC;
+	cfg.holdoff = 0;
+# if RETRIGGER_BENCH == 1
+	cfg.trigger[0] = TRIG_CHAN_1_RISE;
+# elif RETRIGGER_BENCH == 2
+	cfg.mode = MODE_STROBE;
+	cfg.trigger[0] = TRIG_MANUAL;
+	cfg.freq = 100;
+	cfg.freq_unit = RATE_KHZ;
+	cfg.len = 10;
+	cfg.len_unit = DUR_MICROSEC;
+# endif
+	cfg.ready = READY_YES;
+	/* Hold the encoder button up; the harness drives the trigger */
+	DDRB |= (1 << 2);
+	PORTB |= (1 << 2);
 }
+#endif
 
-static void
-sleep_for_interrupt(void)
+/*
+ * Sleep until the next interrupt if the output engine is running.
+ * The CPU is kept asleep while edges are pending so the interrupt
+ * latency stays constant. Returns 0 once the engine is idle.
+ */
+static int
+sleep_output_busy(void)
 {
 	set_sleep_mode(SLEEP_MODE_IDLE);
 	cli();
+	if (!output_busy()) {
+		sei();
+		return 0;
+	}
 	sleep_enable();
 	sei();
 	sleep_cpu();
 	sleep_disable();
+	return 1;
 }
 
+/*
+ * The LCD queue's interrupt may use the bus only when no output edge is
+ * due within LCD_QUIET_CYCLES, so it never delays the output engine.
+ */
+#define LCD_QUIET_CYCLES	256
+
 static int
-evaluate_input(int channel_mode)
+lcd_quiet(void)
 {
-	/* Digital inputs and encoder are active-high */
-	switch (channel_mode) {
-	case TRIG_CHAN_1:
-		return (PINA & (1<<4)) == 0;
-	case TRIG_CHAN_1_NOT:
-		return (PINA & (1<<4)) != 0;
-	case TRIG_CHAN_2:
-		return (PINA & (1<<5)) == 0;
-	case TRIG_CHAN_2_NOT:
-		return (PINA & (1<<5)) != 0;
-	case TRIG_MANUAL:
-		return (PINB & (1<<3)) == 0;
-	case TRIG_NONE:
-	default:
-		return 0;
-	}
+	return output_quiet(LCD_QUIET_CYCLES);
 }
 
-static uint32_t
-duration_to_cycles(int n, int unit)
+/* Show triggers fired / detected, including missed */
+static void
+show_counts(void)
 {
-	switch (unit) {
-	case DUR_MICROSEC:
-		return n * (F_CPU / 1000000);
-	case DUR_MILLISEC:
-		return n * (F_CPU / 1000);
-	case DUR_SEC:
-		return n * F_CPU;
-	}
-	return 0;
-}
+	uint16_t detected, fired;
 
-static uint32_t
-freq_to_cycles(int f, int unit)
-{
-	switch (unit) {
-	case RATE_MHZ:
-		return (F_CPU / 1000000) / f;
-	case RATE_KHZ:
-		return (F_CPU / 1000) / f;
-	case RATE_HZ:
-		return F_CPU / f;
-	case RATE_MILLI_HZ:
-		return (F_CPU * 1000) / f;
-	}
-	return 0;
+	trigger_counts(&detected, &fired);
+	lcd_moveto(0, 0);
+	lcd_string_P(PSTR("** ARMED "));
+	lcd_string(ntod(fired));
+	lcd_char('/');
+	lcd_string(ntod(detected));
+	lcd_clear_eol();
+	lcd_flush();
 }
 
-/*
- * prepare_wait() / LONG_WAIT() implement delays accurate to 6 cycles
- * over ranges up to ~1k sec.
- */
-
-struct longwait {
-	uint32_t t50m;
-	uint16_t t768;
-	uint8_t t3;
-	uint8_t tiny;
-};
-
 static void
 dump_longwait(struct longwait *lw) {
 	lcd_string(ntod(lw->t50m));
@@ -147,91 +153,6 @@ dump_longwait(struct longwait *lw) {
 	lcd_clear_eol();
 }
 
-static void
-prepare_wait(uint32_t t, struct longwait *lw)
-{
-	memset(lw, 0, sizeof(*lw));
-	/* Tiny delays use nop sled */
-	if (t < 40) {
-		lw->tiny = 40 - (t < 14 ? 0 : t - 14);
-		return;
-	}
-	/* Take off some cycles for comparisons (determined empirically) */
-	t -= 36;
-	lw->t50m = t / 50000000; /* ~max 256*3 cycles that fit a u16 */
-	t %= 50000000;
-	lw->t768 = t / 768; /* Max _delay_loop_1() length = 236*3 cycles */
-	t %= 768;
-	lw->t3 = t / 3; /* _delay_loop_1() takes 3 cycles per loop */
-}
-
-#define LONG_WAIT(lw) do { \
-	uint32_t __i; \
-	uint16_t __j; \
-	\
-	if (lw.tiny != 0) { \
-		/* Really short delays jump into a nop sled */ \
-		__asm__ volatile ( \
-			"ldi r31, pm_hi8(1f)" "\n\t" \
-			"ldi r30, pm_lo8(1f)" "\n\t" \
-			"add r30, %0" "\n\t" \
-			"adc r31, __zero_reg__" "\n\t" \
-			"ijmp" "\n\t" \
-			"1:" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			"nop" "\n\t" \
-			: /* no output */ \
-			: "l" (lw.tiny) \
-			: "r30", "r31" \
-		); \
-	} else { \
-		/* Longer delays use the smallest possible counter */ \
-		for (__i = lw.t50m; __i != 0; __i--) \
-			__builtin_avr_delay_cycles(50000000); \
-		for (__j = lw.t768; __j != 0; __j--) \
-			__builtin_avr_delay_cycles(762); /* empirical */ \
-		if (lw.t3 != 0) /* time == 0 means sleep for 256*3 cycles! */ \
-			_delay_loop_1(lw.t3); \
-	} \
-} while (0)
 
 static void
 timing_test(void)
@@ -251,6 +172,11 @@ timing_test(void)
 	dump_longwait(&on);
 	lcd_moveto(0, 1);
 	dump_longwait(&off);
+	lcd_flush();
+	/* The LCD interrupt would disturb the pulses below */
+	sei();
+	lcd_sync();
+	cli();
 
 	for (;;) {
 		PORTA = 0x0f;
@@ -263,10 +189,10 @@ timing_test(void)
 int
 main(void)
 {
-	int i, ready1, ready2, done;
-	uint32_t j, wait1, wait2, on, off, holdoff, cycle_len, duration, ncyc;
-	struct longwait wait1_l, wait2_l, on_l, off_l, holdoff_l, cycle_len_l;
-	uint8_t off_before_ch2, strobe_out;
+	int done;
+	struct schedule sched;
+	uint8_t counted, calibrated;
+	uint16_t latency;
 
 	/*
 	 * NB. external xtal. To select "write lfuse 0 0x6f"
@@ -292,29 +218,43 @@ main(void)
 	PORTD = 0x00;
 	PORTA = 0x00;
 
+	/*
+	 * Measure the busy-wait overheads for this build before anything
+	 * is prepared with them; fall back to the last good measurement.
+	 */
+	BOOT_MARK(calibrated = wait_calibrate(output_time_wait) == 0);
+	if (!calibrated)
+		(void)persist_cal_load(&wait_cal);
+
+	output_setup();
+	lcd_set_quiet(lcd_quiet);
 	lcd_setup();
 	lcd_display(1, 0, 1);
-	lcd_string("OK ");
+	lcd_string_P(PSTR("OK "));
 	lcd_moveto(0, 0);
+	lcd_flush();
 
 	reset_config();
+	BOOT_MARK((void)persist_load(&cfg));
 	event_setup();
+	tick_setup();
 	encoder_setup();
 
-	/* Enable interrupts for buttons */
+	/*
+	 * Latch button changes for trigger_wait(). The buttons and encoder
+	 * are otherwise sampled from the tick; see input.h.
+	 */
 	PCMSK1 |= (1 << 2)|(1 << 3);
-	PCICR |= (1 << PCIE1);
 
 	sei();
+	if (calibrated)
+		persist_cal_save(&wait_cal);
+	BOOT_MARK((void)0);
 
 	for (;;) {
-		/* Disable interrupts for inputs */
-		PCMSK0 &= ~((1 << 4) | (1 << 5));
-		PCICR &= ~(1 << PCIE0);
-
 		/* Drain any queued events */
 		event_drain();
-		running = 0;
+		encoder_reset();
 
 		/* Input lights off */
 		PORTB &= ~(1 << 4);
@@ -324,209 +264,81 @@ main(void)
 		 * Let the user edit the configuration. This ends when they
 		 * select "ready".
 		 */
+#ifdef RETRIGGER_BENCH
+		bench_config();
+#else
 		config_edit();
+#endif
 
 		/* In running mode now */
-		cli();
-		running = 1; /* Accessed in interrupt handler */
-		sei();
 		lcd_display(1, 0, 0);
 
-		/* Calculate delays. */
-		wait1 = duration_to_cycles(cfg.wait, cfg.wait_unit);
-		wait2 = duration_to_cycles(cfg.wait2, cfg.wait_unit);
-		on = duration_to_cycles(cfg.on, cfg.on_unit);
-		holdoff = duration_to_cycles(cfg.holdoff, cfg.holdoff_unit);
-		duration = duration_to_cycles(cfg.len, cfg.len_unit);
-		cycle_len = freq_to_cycles(cfg.freq, cfg.freq_unit);
-		ncyc = (duration + cycle_len - 1) / cycle_len;
-
-		if (on > cycle_len)
-			on = cycle_len - 1;
-		if (on == 0 || (cfg.mode == MODE_STROBE &&
-		    (on >= cycle_len || ncyc < 1))) {
-			lcd_clear();
-			lcd_string("INVALID PARAMETERS");
-			_delay_ms(5 * 1000);
+		/* Keep what's being armed; EEPROM writes would jitter output */
+		persist_save(&cfg);
+		persist_sync();
+
+		/* Compile the output program and trigger expression */
+		if (schedule_compile(&cfg, &sched) != 0 ||
+		    trigger_arm(&cfg) != 0) {
+			/* config_edit() won't allow this; back there if so */
 			cfg.ready = READY_NO;
 			continue;
 		}
-		off = cycle_len - on;
-
-		off_before_ch2 = 0;
-		if (cfg.mode == MODE_ONESHOT) {
-			if (on < wait2) {
-				off_before_ch2 = 1;
-				wait2 -= on;
-			} else {
-				off_before_ch2 = 0;
-				on -= wait2;
-			}
-		}
 
 		/* Turn the input lights on */
-		if (cfg.trigger[0] == TRIG_CHAN_1 ||
-		    cfg.trigger[0] == TRIG_CHAN_1_NOT ||
-		    cfg.trigger[1] == TRIG_CHAN_1 ||
-		    cfg.trigger[1] == TRIG_CHAN_1_NOT)
+		if ((trigger_inputs() & TRIG_IDX_IN1) != 0)
 			PORTB |= (1 << 4);
-		if (cfg.trigger[0] == TRIG_CHAN_2 ||
-		    cfg.trigger[0] == TRIG_CHAN_2_NOT ||
-		    cfg.trigger[1] == TRIG_CHAN_2 ||
-		    cfg.trigger[1] == TRIG_CHAN_2_NOT)
+		if ((trigger_inputs() & TRIG_IDX_IN2) != 0)
 			PORTD |= (1 << 7);
 
-		/* Enable interrupt for inputs. */
-		PCMSK0 |= (1 << 4) | (1 << 5);
-		PCICR |= (1 << PCIE0);
-
-		for (done = 0; !done;) {
-			lcd_moveto(0, 0);
-			lcd_string("** RUNNING: ");
-			lcd_string(cfg.mode == MODE_ONESHOT ?
-			    "ONESHOT" : "STROBE");
-			lcd_clear_eol();
-
-			/* Prepare output value for strobe */
-			switch (cfg.output) {
-			case OUT_CH1:
-				strobe_out = (1 << 1);
-				break;
-			case OUT_CH2:
-				strobe_out = (1 << 0);
-				break;
-			case OUT_BOTH:
-				strobe_out = (1 << 0) | (1 << 1);
-				break;
-			default:
-				strobe_out = 0;
-			}
-
-			/* Prepare timer values */
-			prepare_wait(wait1, &wait1_l);
-			prepare_wait(wait2, &wait2_l);
-			prepare_wait(on, &on_l);
-			prepare_wait(holdoff, &holdoff_l);
-			prepare_wait(off, &off_l);
-
-#ifdef DEBUG_RUN
-			lcd_moveto(0, 0);
-			dump_longwait(&holdoff_l);
-#endif
-
-			/* XXX fudge these times for comparison, etc. costs */
-			/* XXX vary sleep mode for delay? */
-
-			/* Wait for input. */
-			event_drain();
-			sleep_for_interrupt();
-
-			/* Terminate running state on encoder press */
-			if ((PINB & (1 << 2)) == 0)
-				break;
-
-#ifdef DEBUG_RUN
-			lcd_moveto(0, 0);
-			lcd_string("** WAKEUP");
-			lcd_clear_eol();
+		/* The tick interrupt would jitter output edges */
+		tick_enable(0);
+		latency = trigger_latency();
+		show_counts();
+		/* trigger_wait() blocks interrupts; show it first */
+		lcd_sync();
+		event_drain();
+		encoder_reset();
+#ifdef RETRIGGER_BENCH
+		PORTA |= (1 << 0);
+		PORTA &= ~(1 << 0);
 #endif
 
-			/* Evaluate trigger inputs */
-			ready1 = evaluate_input(cfg.trigger[0]);
-			ready2 = evaluate_input(cfg.trigger[1]);
-			switch (cfg.combine) {
-			case COMBINE_OR:
-				if (!(ready1 || ready2))
-					continue;
-				break;
-			case COMBINE_AND:
-				if (!(ready1 && ready2))
-					continue;
-				break;
-			case COMBINE_XOR:
-				if (!(ready1 ^ ready2))
-					continue;
-				break;
-			case COMBINE_NONE:
-			default:
-				if (!ready1)
-					continue;
+		/*
+		 * Nothing between runs but re-arming: the program's start
+		 * state is reused from the first pass and the display is
+		 * updated once the edges are done, while the CPU would
+		 * otherwise sleep. If that's cut short by re-arming, the
+		 * rest is written during the next run.
+		 */
+		for (done = 0; !done;) {
+			/* Wait for input; the encoder button stops the run */
+			output_arm(latency);
+			if (!trigger_wait())
 				break;
-			}
-
-#ifdef DEBUG_RUN
-			lcd_moveto(0, 0);
-			lcd_string("** TRIGGERED");
-			lcd_clear_eol();
-#endif
-
-			/* Wait initial delay. */
-			LONG_WAIT(wait1_l);
 
-#ifdef DEBUG_RUN
-			lcd_moveto(0, 0);
-			lcd_string("** GO");
-			lcd_clear_eol();
-#endif
-
-			if (cfg.mode == MODE_ONESHOT) {
-				/* Output on */
-				switch (cfg.output) {
-				case OUT_CH1:
-					PORTA = (1 << 1);
-					LONG_WAIT(on_l);
-					PORTA = 0;
-					break;
-				case OUT_CH2:
-					PORTA = (1 << 0);
-					LONG_WAIT(on_l);
-					PORTA = 0;
-					break;
-				case OUT_BOTH:
-					PORTA = (1 << 1);
-					if (off_before_ch2) {
-						LONG_WAIT(on_l);
-						PORTA = 0;
-						LONG_WAIT(wait2_l);
-						PORTA = (1 << 0);
-						LONG_WAIT(on_l);
-						PORTA = 0;
-					} else {
-						LONG_WAIT(wait2_l);
-						PORTA = (1 << 0) | (1 << 1);
-						LONG_WAIT(on_l);
-						PORTA = (1 << 0);
-						LONG_WAIT(wait2_l);
-						PORTA = 0;
-					}
-					break;
-				}
-				if (cfg.holdoff == -1) {
+			counted = 0;
+			while (sleep_output_busy()) {
+				/* Encoder press aborts, even during holdoff */
+				if ((PINB & (1 << 2)) == 0) {
+					output_stop();
 					done = 1;
-					break;
 				}
-				lcd_moveto(0, 0);
-				lcd_string("** HOLDOFF");
-				lcd_clear_eol();
-				LONG_WAIT(holdoff_l);
-			} else {
-				for (j = 0; j < ncyc; j++) {
-					PORTA = strobe_out;
-					LONG_WAIT(on_l);
-					PORTA = 0;
-					LONG_WAIT(off_l);
-				}
-				/*
-				 * If we are not in manual trigger, then
-				 * drop back to editor for explicit re-arming.
-				 */
-				if (cfg.trigger[0] != TRIG_MANUAL &&
-				    cfg.trigger[1] != TRIG_MANUAL) {
-					done = 1;
-					break;
+				if (!counted &&
+				    output_step() == sched.holdoff_step) {
+					/* Edges done; count retriggers */
+					trigger_monitor(1);
+					show_counts();
+					counted = 1;
 				}
 			}
+			trigger_monitor(0);
+			if (sched.once)
+				done = 1;
+			else if (!counted)
+				show_counts();
 		}
+		tick_enable(1);
 		/* Run completed - back to edit mode */
 		cfg.ready = READY_NO;
 	}
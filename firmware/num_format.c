@@ -40,6 +40,34 @@ ntod(long int n)
 	return &(ret[i + 1]);
 }
 
+const char *
+ntodp(long int n, unsigned int dp)
+{
+	static char ret[sizeof(long int) * 4 + 4];
+	const char *s;
+	size_t l, pad, i = 0;
+
+	if (n < 0) {
+		ret[i++] = '-';
+		n = -n;
+	}
+	s = ntod(n);
+	l = strlen(s);
+	/* Zero-pad so there's a digit before the point */
+	pad = l <= dp ? dp + 1 - l : 0;
+	for (l += pad; l > 0 && i < sizeof(ret) - 2; l--) {
+		if (l == dp)
+			ret[i++] = '.';
+		if (pad > 0) {
+			ret[i++] = '0';
+			pad--;
+		} else
+			ret[i++] = *s++;
+	}
+	ret[i] = '\0';
+	return ret;
+}
+
 const char *
 ntoh(long unsigned int n, int preamble)
 {
@@ -22,6 +22,12 @@
 /* Convert an integer to decimal */
 const char *ntod(long int n);
 
+/*
+ * Convert an integer to decimal with a point 'dp' digits from the right,
+ * e.g. ntodp(70004, 4) is "7.0004"
+ */
+const char *ntodp(long int n, unsigned int dp);
+
 /*
  * Convert an unsigned integer to hexadecimal.
  * If 'preamble' set, prepend '0x'
@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wait.h"
+#include "strobe.h"
+#include "output.h"
+
+#define OUT_MASK	((1 << OUT_PIN_CH1) | (1 << OUT_PIN_CH2))
+#define STEP_END	0xff
+
+/* How a step's delay is timed */
+#define STEP_IRQ	0	/* Compare-match interrupt */
+#define STEP_PACED	1	/* Busy-waited against the counter */
+#define STEP_WAIT	2	/* Busy-waited with LONG_WAIT() */
+#define STEP_BURST	3	/* Paced strobe burst; see strobe.h */
+
+struct step {
+	uint8_t out;		/* Output port value */
+	uint8_t busy;		/* STEP_* */
+	uint16_t dlo;		/* Cycles after previous step, mod 2^16 */
+	uint32_t dhi;		/* ...and in whole 2^16 laps */
+	struct longwait lw;	/* Loop counts for busy-waited delays */
+};
+
+/* The program */
+static struct step steps[OUTPUT_MAX_STEPS];
+static uint8_t nsteps, loop_first, loop_end;
+static uint32_t loop_count;
+static struct strobe_burst burst;	/* The STEP_BURST step's burst */
+static uint8_t burst_off;		/* ...and its falling edge value */
+
+/* Playback state; shared with the interrupt handler */
+static volatile uint8_t cur = STEP_END;	/* Step waiting to be played */
+static uint8_t cur_out;			/* Its output value */
+static uint16_t cur_t;			/* Its logical time */
+static uint16_t laps;			/* Compare matches to skip first */
+static uint16_t laps_hi;		/* ...plus this many times 2^15 */
+static uint32_t loops_left;
+
+/* Set up by output_arm() for output_fire() */
+uint8_t output_lead_out, output_lead_busy;
+static uint8_t lead_step;
+static uint8_t lead_busy;		/* STEP_* it is busy-waited with */
+static uint16_t lead_t;
+static struct longwait lead_lw;
+
+/*
+ * The state output_arm() starts the program from, worked out once per
+ * program by arm_prepare() so that re-arming between triggers is only
+ * a few loads and stores.
+ */
+static struct {
+	uint8_t valid;
+	uint16_t latency;	/* Trigger latency it was worked out for */
+	uint8_t lead_out, lead_busy;
+	uint8_t step, out;	/* First step played from the timer */
+	uint16_t ocr, t;
+	uint16_t laps, laps_hi;
+	uint32_t loops;
+} start;
+
+/* Return the step to play after 'i', or STEP_END if there are no more */
+static uint8_t
+next_step(uint8_t i)
+{
+	i++;
+	if (i == loop_end && loops_left > 1) {
+		loops_left--;
+		i = loop_first;
+	} else if (i == loop_first && loops_left == 0)
+		i = loop_end;
+	return i < nsteps ? i : STEP_END;
+}
+
+/*
+ * Write 'out' to the port exactly when the counter reaches logical time
+ * 't', or at once if that has passed. The counter is polled until 't' is
+ * less than a nop sled away and the remainder is burned in the sled, so
+ * the write lands on its cycle. Each edge is timed from the counter and
+ * not from the last, so errors can't accumulate over a strobe.
+ */
+static void
+pace_write(uint16_t t, uint8_t out)
+{
+	uint16_t now, r;
+
+	__asm__ volatile (
+		"1:"					"\n\t"
+		"lds	%A[now], %[tcntl]"		"\n\t"
+		"lds	%B[now], %[tcnth]"		"\n\t"
+		"movw	%A[r], %A[t]"			"\n\t"
+		"sub	%A[r], %A[now]"			"\n\t"
+		"sbc	%B[r], %B[now]"			"\n\t"
+		"subi	%A[r], lo8(%[fixed])"		"\n\t"
+		"sbci	%B[r], hi8(%[fixed])"		"\n\t"
+		/* 2f is past the sled, out of a branch's reach */
+		"brpl	3f"				"\n\t"
+		"rjmp	2f"				"\n\t"
+		"3:"					"\n\t"
+		"cpi	%A[r], %[sled]"			"\n\t"
+		"cpc	%B[r], __zero_reg__"		"\n\t"
+		"brsh	1b"				"\n\t"
+		"ldi	r30, pm_lo8(2f)"		"\n\t"
+		"ldi	r31, pm_hi8(2f)"		"\n\t"
+		"sub	r30, %A[r]"			"\n\t"
+		"sbc	r31, __zero_reg__"		"\n\t"
+		"ijmp"					"\n\t"
+		".rept	%[sled]"			"\n\t"
+		"nop"					"\n\t"
+		".endr"					"\n\t"
+		"2:"					"\n\t"
+		"out	%[port], %[out]"		"\n\t"
+		: [now] "=&r" (now), [r] "=&d" (r)
+		: [t] "r" (t), [out] "r" (out),
+		  [tcntl] "n" (_SFR_MEM_ADDR(TCNT1L)),
+		  [tcnth] "n" (_SFR_MEM_ADDR(TCNT1H)),
+		  [port] "I" (_SFR_IO_ADDR(OUT_PORT)),
+		  [fixed] "n" (OUTPUT_PACE_FIXED),
+		  [sled] "M" (OUTPUT_PACE_SLED)
+		: "r30", "r31"
+	);
+}
+
+/*
+ * Busy-wait the 'busy' way to set the port to 'out' at logical time 't',
+ * timing a STEP_WAIT with 'lw'. Returns the logical time of the last
+ * edge. This holds the engine's only LONG_WAIT(), which is what
+ * output_time_wait() calibrates, so it must not be inlined.
+ */
+static uint16_t __attribute__((noinline))
+busy_write(uint8_t busy, uint8_t out, uint16_t t, const struct longwait *lw)
+{
+	switch (busy) {
+	case STEP_PACED:
+		pace_write(t, out);
+		break;
+	case STEP_BURST:
+		strobe_play(t, out, burst_off, burst.count, burst.entry);
+		t += burst.len;
+		break;
+	default:
+		LONG_WAIT((*lw));
+		OUT_PORT = out;
+		break;
+	}
+	return t;
+}
+
+uint16_t
+output_time_wait(const struct longwait *lw)
+{
+	uint16_t start;
+
+	/* Rewrites the port as it is; nothing else touches it yet */
+	start = TCNT1;
+	(void)busy_write(STEP_WAIT, OUT_PORT, 0, lw);
+	return TCNT1 - start;
+}
+
+/*
+ * Skip 'n' compare matches before the next step. Only the low part is
+ * checked before the port write, so the handler's latency doesn't depend
+ * on the length of the delay; it's kept non-zero while any laps remain.
+ */
+static void
+set_laps(uint32_t n)
+{
+	laps = n & 0x7fff;
+	laps_hi = n >> 15;
+	if (laps == 0 && laps_hi != 0) {
+		laps = 0x8000;
+		laps_hi--;
+	}
+}
+
+static void
+timer_stop(void)
+{
+	TCCR1B = 0;
+	TIMSK1 &= ~(1 << OCIE1A);
+	cur = STEP_END;
+}
+
+/*
+ * Play any busy-waited steps following 'i', which was played at logical
+ * time 't', and schedule the next one. Must be called with interrupts
+ * disabled.
+ */
+static void
+schedule(uint8_t i, uint16_t t)
+{
+	uint32_t n;
+
+	while ((i = next_step(i)) != STEP_END && steps[i].busy)
+		t = busy_write(steps[i].busy, steps[i].out, t + steps[i].dlo,
+		    &steps[i].lw);
+	if (i == STEP_END) {
+		timer_stop();
+		return;
+	}
+	/*
+	 * The counter tracks logical time. It is only 16 bits, so longer
+	 * delays are made up of whole laps before the final match, less one
+	 * if the match for the remainder has already gone by.
+	 */
+	OCR1A = t + steps[i].dlo - OUTPUT_IRQ_LATENCY;
+	TIFR1 = (1 << OCF1A);
+	n = steps[i].dhi;
+	if ((uint16_t)(TCNT1 - t) + (uint32_t)OUTPUT_IRQ_LATENCY + 1 >
+	    steps[i].dlo)
+		n--;
+	set_laps(n);
+	cur_out = steps[i].out;
+	cur_t = t + steps[i].dlo;
+	cur = i;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+	if (laps != 0) {
+		if (--laps == 0 && laps_hi != 0) {
+			laps = 0x8000;
+			laps_hi--;
+		}
+		return;
+	}
+	OUT_PORT = cur_out;
+	schedule(cur, cur_t);
+}
+
+/* Busy-wait for a short first step; called from output_fire() */
+void
+output_lead(void)
+{
+	schedule(lead_step, busy_write(lead_busy, steps[lead_step].out,
+	    lead_t, &lead_lw));
+}
+
+void
+output_setup(void)
+{
+	TCCR1A = TCCR1B = TCCR1C = 0;
+	TIMSK1 = 0;
+	OUT_DDR |= OUT_MASK;
+	OUT_PORT &= ~OUT_MASK;
+	output_reset();
+}
+
+void
+output_reset(void)
+{
+	nsteps = 0;
+	loop_first = loop_end = STEP_END;
+	loop_count = 0;
+	start.valid = 0;
+}
+
+int
+output_add(uint8_t out, cycles_t delay)
+{
+	struct step *s;
+
+	if (nsteps >= OUTPUT_MAX_STEPS)
+		return -1;
+	start.valid = 0;
+	s = &steps[nsteps];
+	memset(s, 0, sizeof(*s));
+	s->out = out;
+	s->dlo = delay;
+	s->dhi = delay >> 16;
+	if (delay < OUTPUT_MIN_PACED_CYCLES) {
+		s->busy = STEP_WAIT;
+		prepare_wait(delay, &s->lw);
+	} else if (delay < OUTPUT_MIN_IRQ_CYCLES)
+		s->busy = STEP_PACED;
+	return nsteps++;
+}
+
+int
+output_add_burst(uint8_t on, uint8_t off, cycles_t delay,
+    const struct strobe_burst *b)
+{
+	int r;
+
+	/* Wait out most of a long delay on the timer, then pace the rest */
+	if (delay >= OUTPUT_MIN_IRQ_CYCLES + OUTPUT_BURST_LEAD) {
+		if (output_add(nsteps ? steps[nsteps - 1].out : 0,
+		    delay - OUTPUT_BURST_LEAD) == -1)
+			return -1;
+		delay = OUTPUT_BURST_LEAD;
+	}
+	if ((r = output_add(on, delay)) == -1)
+		return -1;
+	steps[r].busy = STEP_BURST;
+	burst = *b;
+	burst_off = off;
+	return r;
+}
+
+void
+output_repeat(uint8_t first, uint32_t count)
+{
+	loop_first = first;
+	loop_end = nsteps;
+	loop_count = count;
+	start.valid = 0;
+}
+
+/* The whole delay of step 'i' */
+static cycles_t
+step_delay(uint8_t i)
+{
+	return ((cycles_t)steps[i].dhi << 16) | steps[i].dlo;
+}
+
+/*
+ * Work out how output_arm() starts the current program into 'start'.
+ * Must be called with the engine stopped.
+ */
+static void
+arm_prepare(uint16_t latency)
+{
+	uint8_t i;
+	cycles_t t = 0, rem;
+
+	memset(&start, 0, sizeof(start));
+	start.valid = 1;
+	start.latency = latency;
+	start.ocr = latency - 1;
+	start.step = STEP_END;
+	loops_left = loop_count;
+
+	/* A first step due before the timer starts is played at once */
+	i = next_step(STEP_END);
+	if (i != STEP_END && steps[i].busy != STEP_BURST &&
+	    step_delay(i) <= latency) {
+		start.lead_out = steps[i].out;
+		t = step_delay(i);
+		i = next_step(i);
+	}
+	start.loops = loops_left;
+	if (i == STEP_END)
+		return;
+
+	/* Cycles from output_fire() until the step is due */
+	t += step_delay(i);
+	rem = t > latency ? t - latency : 0;
+	start.step = i;
+	/* Bursts are paced from here even up to OUTPUT_BURST_LEAD later */
+	if (rem < OUTPUT_MIN_IRQ_CYCLES || steps[i].busy == STEP_BURST) {
+		if (steps[i].busy == STEP_BURST)
+			lead_busy = STEP_BURST;
+		else if (rem >= OUTPUT_MIN_PACED_CYCLES)
+			lead_busy = STEP_PACED;
+		else {
+			lead_busy = STEP_WAIT;
+			prepare_wait(rem, &lead_lw);
+		}
+		lead_step = i;
+		lead_t = t;
+		start.lead_busy = 1;
+		return;
+	}
+	start.ocr = (uint16_t)t - OUTPUT_IRQ_LATENCY;
+	set_laps((rem - OUTPUT_IRQ_LATENCY - 1) >> 16);
+	start.laps = laps;
+	start.laps_hi = laps_hi;
+	start.out = steps[i].out;
+	start.t = t;
+}
+
+void
+output_arm(uint16_t latency)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		timer_stop();
+		if (!start.valid || start.latency != latency)
+			arm_prepare(latency);
+		TCNT1 = latency;
+		OCR1A = start.ocr;
+		TIFR1 = (1 << OCF1A);
+		TIMSK1 |= (1 << OCIE1A);
+		laps = start.laps;
+		laps_hi = start.laps_hi;
+		loops_left = start.loops;
+		output_lead_out = start.lead_out;
+		output_lead_busy = start.lead_busy;
+		cur_out = start.out;
+		cur_t = start.t;
+		cur = start.step;
+	}
+}
+
+void
+output_stop(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		timer_stop();
+		output_lead_busy = 0;
+		OUT_PORT &= ~OUT_MASK;
+	}
+}
+
+int
+output_busy(void)
+{
+	return cur != STEP_END;
+}
+
+int
+output_quiet(uint16_t cycles)
+{
+	/* Not started, idle or laps before the next real match */
+	if ((TCCR1B & (1 << CS10)) == 0 || cur == STEP_END || laps != 0)
+		return 1;
+	return (uint16_t)(OCR1A - TCNT1) > cycles;
+}
+
+uint8_t
+output_step(void)
+{
+	return cur;
+}
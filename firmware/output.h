@@ -0,0 +1,178 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Timer1 compare-match output engine.
+ *
+ * A program is a list of steps, each of which sets the output port to a
+ * value a number of CPU cycles after the previous step. Timer1 free-runs
+ * at F_CPU and the steps are played from its compare-match A interrupt,
+ * so the CPU is free between edges. Delays too short for the interrupt
+ * handler to turn around are busy-waited inside it: by polling the
+ * counter down to the exact cycle where possible, otherwise using
+ * LONG_WAIT().
+ *
+ * Times are measured from a logical origin, normally the trigger input
+ * edge. The timer is started with the counter already advanced by the
+ * trigger latency and compare matches are scheduled early by the
+ * interrupt latency, so edges land on their requested cycle.
+ *
+ * NB. OC1A/OC1B are PD5/PD4 which this board uses for the LCD R/W and
+ * enable lines, so the outputs can't be driven directly by the timer.
+ */
+
+#include <avr/io.h>
+
+/* Output port/pin configuration; also used by the strobe kernels */
+#define OUT_PORT		PORTA
+#define OUT_DDR			DDRA
+#define OUT_PIN_CH1		1
+#define OUT_PIN_CH2		0
+
+/* Maximum number of steps in a program; a two-channel strobe takes 13 */
+#define OUTPUT_MAX_STEPS	16
+
+/*
+ * Delays shorter than this are busy-waited in the interrupt handler
+ * rather than scheduled on the timer.
+ */
+#define OUTPUT_MIN_IRQ_CYCLES	256
+
+/*
+ * Delays at least this long are busy-waited by polling the counter,
+ * which lands every edge on its cycle regardless of the time taken to
+ * reach the next step. Shorter ones can't cover the per-step overhead
+ * (~50 cycles + OUTPUT_PACE_FIXED) and use LONG_WAIT(), which is
+ * accurate to a few cycles per step but accumulates over a strobe.
+ */
+#define OUTPUT_MIN_PACED_CYCLES	96
+
+/*
+ * Cycles from the counter read in the paced wait to its port write, not
+ * counting the nop sled, and the length of the sled.
+ */
+#define OUTPUT_PACE_FIXED	21
+#define OUTPUT_PACE_SLED	64
+
+/*
+ * Cycles from a compare match to the port write in the interrupt handler
+ * with the CPU idle: 4 (response) + 4 (wake from idle) + 3 (vector jmp)
+ * + 29 (prologue and laps check).
+ */
+#define OUTPUT_IRQ_LATENCY	40
+
+/*
+ * Cycles a strobe burst is busy-waited from its compare match; enough to
+ * cover the interrupt latency and strobe_play()'s pacing.
+ */
+#define OUTPUT_BURST_LEAD	128
+
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+#include "cycles.h"
+#include "strobe.h"
+#include "wait.h"
+
+/* Setup the output pins and timer; outputs off. */
+void output_setup(void);
+
+/*
+ * Cycles between two counter reads around the engine's LONG_WAIT()
+ * waiting 'lw', including its call and port write; for wait_calibrate().
+ * Timer1 must be running and the engine idle.
+ */
+uint16_t output_time_wait(const struct longwait *lw);
+
+/* Clear the current program. Must not be called while running. */
+void output_reset(void);
+
+/*
+ * Append a step that sets the output port to 'out' 'delay' cycles after
+ * the previous step (or after the logical origin for the first step).
+ * 'delay' may be up to CYCLES_MAX. Returns the index of the new step or
+ * -1 if the program is full.
+ */
+int output_add(uint8_t out, cycles_t delay);
+
+/*
+ * Append a strobe burst prepared by strobe_prepare(), played by its
+ * kernel so every edge lands on its cycle. The first pulse rises 'delay'
+ * cycles after the previous step, setting the port to 'on'; each pulse
+ * falls to 'off'. The next step's delay counts from the last falling
+ * edge. Bursts can't start sooner than STROBE_PACE_FIXED cycles after
+ * the previous step and a program may have only one. Returns the index
+ * of the burst's step or -1 if the program is full.
+ */
+int output_add_burst(uint8_t on, uint8_t off, cycles_t delay,
+    const struct strobe_burst *b);
+
+/*
+ * Play the steps from 'first' to the end of the program 'count' times in
+ * total. A count of zero ends the program before 'first'.
+ */
+void output_repeat(uint8_t first, uint32_t count);
+
+/*
+ * Prepare the timer to play the current program. 'latency' is the number
+ * of cycles between the logical origin and output_fire() starting the
+ * timer. Steps due before then are played as soon as possible. The
+ * start state is worked out on the first call for a program and reused
+ * after, so re-arming between triggers costs only a few microseconds.
+ */
+void output_arm(uint16_t latency);
+
+/* Internal state for output_fire() */
+extern uint8_t output_lead_out, output_lead_busy;
+void output_lead(void);
+
+/*
+ * Start playing the armed program. This is in the trigger hot path, so
+ * the port write for an immediate first step and the timer start come
+ * before anything else.
+ */
+static inline void
+output_fire(void)
+{
+	OUT_PORT = output_lead_out;
+	TCCR1B = (1 << CS10);
+	if (output_lead_busy)
+		output_lead();
+}
+
+/* Stop the program immediately and turn the outputs off. */
+void output_stop(void);
+
+/* Returns non-zero while a program is being played */
+int output_busy(void);
+
+/*
+ * Returns non-zero if no output edge is due in the next 'cycles' cycles,
+ * i.e. an interrupt handler that short may run without delaying one.
+ */
+int output_quiet(uint16_t cycles);
+
+/*
+ * Returns the index of the step that the engine is waiting to play or
+ * 0xff if idle.
+ */
+uint8_t output_step(void);
+#endif /* __ASSEMBLER__ */
+
+#endif /* OUTPUT_H */
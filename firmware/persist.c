@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "config.h"
+#include "wait.h"
+#include "persist.h"
+
+struct slot {
+	uint16_t seq;		/* Newer slots have later numbers; wraps */
+	struct config c;
+	uint16_t crc;		/* Of seq and c */
+};
+
+struct cal {
+	struct wait_cal w;
+	uint16_t crc;		/* Of w */
+};
+
+static struct slot slots[PERSIST_SLOTS] EEMEM;
+static struct config presets[PERSIST_PRESETS] EEMEM;
+static struct cal cal EEMEM;
+
+/* The slot being, or last, written and its index */
+static struct slot wbuf;
+static uint8_t wslot = PERSIST_SLOTS - 1;
+/* The preset or calibration being written */
+static struct config pbuf;
+static struct cal cbuf;
+
+/* Write in progress: 'wlen' bytes from 'wsrc' to EEPROM at 'wdst' */
+static const uint8_t *wsrc;
+static uint8_t *wdst;
+static uint8_t wlen;
+static volatile uint8_t wpos;	/* Idle once it reaches wlen */
+
+static uint16_t
+crc_block(const void *b, size_t len)
+{
+	const uint8_t *p = b;
+	uint16_t crc = 0xffff;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		crc = _crc_ccitt_update(crc, p[i]);
+	return crc;
+}
+
+static uint16_t
+slot_crc(const struct slot *s)
+{
+	return crc_block(s, offsetof(struct slot, crc));
+}
+
+ISR(EE_READY_vect)
+{
+	uint8_t i = wpos;
+
+	if (i >= wlen) {
+		EECR &= ~(1 << EERIE);
+		return;
+	}
+	/* Unchanged bytes aren't rewritten; we're straight back here */
+	eeprom_update_byte(wdst + i, wsrc[i]);
+	wpos = i + 1;
+}
+
+/* Start writing 'len' bytes from 'src' to 'dst'; any previous is done */
+static void
+write_start(const void *src, void *dst, uint8_t len)
+{
+	wsrc = src;
+	wdst = dst;
+	wlen = len;
+	__asm__ volatile ("" ::: "memory");
+	wpos = 0;
+	EECR |= (1 << EERIE);
+}
+
+int
+persist_load(struct config *c)
+{
+	struct slot s;
+	uint8_t i, found = 0;
+
+	for (i = 0; i < PERSIST_SLOTS; i++) {
+		eeprom_read_block(&s, &slots[i], sizeof(s));
+		if (s.crc != slot_crc(&s) || config_check(&s.c) != 0)
+			continue;
+		if (found && (int16_t)(s.seq - wbuf.seq) <= 0)
+			continue;
+		wbuf = s;
+		wslot = i;
+		found = 1;
+	}
+	if (!found)
+		return -1;
+	*c = wbuf.c;
+	return 0;
+}
+
+void
+persist_save(const struct config *c)
+{
+	struct config n = *c;
+
+	n.ready = READY_NO;
+	config_seal(&n);
+	persist_sync();
+	if (config_equal(&n, &wbuf.c))
+		return;
+	wbuf.seq++;
+	wbuf.c = n;
+	wbuf.crc = slot_crc(&wbuf);
+	wslot = (wslot + 1) % PERSIST_SLOTS;
+	write_start(&wbuf, &slots[wslot], sizeof(wbuf));
+}
+
+int
+persist_preset_load(uint8_t n, struct config *c)
+{
+	struct config p;
+
+	if (n >= PERSIST_PRESETS)
+		return -1;
+	/* It might be half-written */
+	persist_sync();
+	eeprom_read_block(&p, &presets[n], sizeof(p));
+	if (config_check(&p) != 0)
+		return -1;
+	*c = p;
+	return 0;
+}
+
+void
+persist_preset_save(uint8_t n, const struct config *c)
+{
+	if (n >= PERSIST_PRESETS)
+		return;
+	persist_sync();
+	pbuf = *c;
+	pbuf.ready = READY_NO;
+	config_seal(&pbuf);
+	write_start(&pbuf, &presets[n], sizeof(pbuf));
+}
+
+int
+persist_cal_load(struct wait_cal *w)
+{
+	struct cal c;
+
+	persist_sync();
+	eeprom_read_block(&c, &cal, sizeof(c));
+	if (c.crc != crc_block(&c.w, sizeof(c.w)) || wait_cal_check(&c.w) != 0)
+		return -1;
+	*w = c.w;
+	return 0;
+}
+
+void
+persist_cal_save(const struct wait_cal *w)
+{
+	struct wait_cal saved;
+
+	persist_sync();
+	if (persist_cal_load(&saved) == 0 &&
+	    memcmp(&saved, w, sizeof(saved)) == 0)
+		return;
+	cbuf.w = *w;
+	cbuf.crc = crc_block(&cbuf.w, sizeof(cbuf.w));
+	write_start(&cbuf, &cal, sizeof(cbuf));
+}
+
+void
+persist_sync(void)
+{
+	while (wpos < wlen)
+		;
+	eeprom_busy_wait();
+}
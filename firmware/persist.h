@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+/*
+ * Configuration kept in EEPROM. Each save goes to the next of
+ * PERSIST_SLOTS slots in turn, so each slot is written only once per
+ * PERSIST_SLOTS saves. Each slot holds a sequence number, the sealed
+ * config and a CRC over both. At boot the newest slot that checks out
+ * is restored, so a write cut short by power loss only costs that one
+ * save.
+ *
+ * Presets are kept apart from these: PERSIST_PRESETS sealed configs that
+ * the user saves and recalls by number. So is the last good calibration
+ * of the busy-wait overheads, for boots where measuring goes wrong.
+ *
+ * Saves are written a byte at a time from the EEPROM ready interrupt,
+ * about 3.4ms per byte, so nothing waits for them. That interrupt would
+ * disturb the output engine; persist_sync() before arming.
+ */
+
+#include "config.h"
+#include "wait.h"
+
+#define PERSIST_SLOTS	16
+#define PERSIST_PRESETS	8	/* Saved and recalled by the user */
+
+/*
+ * Restore the newest valid saved config into 'c'. Returns 0 on success
+ * or -1, leaving 'c' untouched, if there is none.
+ */
+int persist_load(struct config *c);
+
+/*
+ * Start saving 'c', with 'ready' cleared, unless it matches what was last
+ * saved. Waits only if the previous save hasn't finished.
+ */
+void persist_save(const struct config *c);
+
+/*
+ * Read preset 'n' into 'c'. Returns 0 on success or -1, leaving 'c'
+ * untouched, if the preset is empty or invalid.
+ */
+int persist_preset_load(uint8_t n, struct config *c);
+
+/* Start saving 'c', with 'ready' cleared, as preset 'n' */
+void persist_preset_save(uint8_t n, const struct config *c);
+
+/*
+ * Read the saved wait calibration into 'w'. Returns 0 on success or -1,
+ * leaving 'w' untouched, if there is none or it fails wait_cal_check().
+ */
+int persist_cal_load(struct wait_cal *w);
+
+/* Start saving calibration 'w' unless it matches what's saved */
+void persist_cal_save(const struct wait_cal *w);
+
+/* Wait for any save in progress to finish; needs interrupts enabled */
+void persist_sync(void);
+
+#endif /* PERSIST_H */
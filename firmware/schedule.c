@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cycles.h"
+#include "ui.h"
+#include "output.h"
+#include "strobe.h"
+#include "schedule.h"
+
+#define CH1	(1 << OUT_PIN_CH1)
+#define CH2	(1 << OUT_PIN_CH2)
+
+/* Output channels for each single-train output mode */
+static const uint8_t output_masks[OUT_BOTH + 1] = {
+	CH1,		/* OUT_CH1 */
+	CH2,		/* OUT_CH2 */
+	CH1 | CH2,	/* OUT_BOTH */
+};
+
+/* A single output transition on one channel */
+struct edge {
+	cycles_t t;	/* Cycles after trigger */
+	uint8_t mask;	/* Channel(s) */
+	uint8_t on;	/* Rising edge */
+};
+
+/* One channel's pulses in a strobe; pulse j rises at start + j * frame */
+struct train {
+	cycles_t start;	/* Cycles after trigger */
+	uint32_t n;	/* Pulses */
+	uint8_t mask;	/* Channel(s) */
+};
+
+/* Where emit_edges() has got to */
+struct emitter {
+	cycles_t last;	/* Time of the last step */
+	uint8_t out;	/* Output port value after it */
+	uint8_t nsteps;	/* Steps emitted */
+};
+
+/*
+ * Fill in the strobe period, its error and the achieved frequency in 't'.
+ * The period is truncated to whole cycles, so the achieved frequency is
+ * never lower than requested.
+ */
+static int
+strobe_timing(int f, int unit, struct timing *t)
+{
+	cycles_t n = rate_cycles(unit), p, rem;
+
+	if (f <= 0 || n == 0)
+		return SCHED_E_NO_FREQ;
+	if ((p = cycles_div(n, f)) == 0)
+		return SCHED_E_TOO_FAST;
+	if (p > CYCLES_MAX)
+		return SCHED_E_TOO_LONG;
+	/* Split n = f * p + rem to keep the dividends small */
+	rem = n - f * p;
+	t->period = p;
+	t->freq_ppm = cycles_div(rem * 1000000, n - rem);
+	t->freq_x10k = (uint32_t)f * 10000 +
+	    cycles_div(rem * 10000 + p / 2, p);
+	return 0;
+}
+
+int
+schedule_timing(const struct config *c, struct timing *t)
+{
+	cycles_t wait1, wait2, len;
+	uint32_t max;
+	int r;
+
+	memset(t, 0, sizeof(*t));
+	if (c->output >= OUT_MAX ||
+	    (c->mode == MODE_ONESHOT && c->output > OUT_BOTH))
+		return SCHED_E_OUTPUT;
+	wait1 = dur_cycles(c->wait, c->wait_unit, NULL);
+	t->on = t->want_on = dur_cycles(c->on, c->on_unit, &t->on_exact);
+	if (t->on == 0)
+		return SCHED_E_NO_PULSE;
+	if (wait1 > CYCLES_MAX || t->on > CYCLES_MAX)
+		return SCHED_E_TOO_LONG;
+	if (c->mode == MODE_ONESHOT) {
+		/* Each step is no longer than one of these */
+		wait2 = dur_cycles(c->wait2, c->wait2_unit, NULL);
+		if (wait2 > CYCLES_MAX || (c->holdoff != -1 &&
+		    dur_cycles(c->holdoff, c->holdoff_unit, NULL) > CYCLES_MAX))
+			return SCHED_E_TOO_LONG;
+		return 0;
+	}
+	if ((r = strobe_timing(c->freq, c->freq_unit, t)) != 0)
+		return r;
+	/* A pulse can't be longer than the period; it's cut short */
+	if (t->on >= t->period)
+		t->on = t->period - 1;
+	if (t->on == 0)
+		return SCHED_E_NO_PULSE;
+	len = dur_cycles(c->len, c->len_unit, NULL);
+	if (len == 0)
+		return SCHED_E_NO_LENGTH;
+	/*
+	 * The engine counts strobe cycles in 32 bits. A period over 32 bits
+	 * is too long for len to overflow it, and otherwise this is
+	 * (len - 1) / period >= UINT32_MAX without the division.
+	 */
+	if (t->period <= UINT32_MAX &&
+	    len - 1 >= (cycles_t)UINT32_MAX * t->period)
+		return SCHED_E_TOO_LONG;
+	/*
+	 * A period that has a strobe kernel is too short for the engine's
+	 * steps, so the kernel must be able to play every pulse. Unrolled
+	 * ones stop at STROBE_UNROLL: ceil(len / period) > max.
+	 */
+	if (c->output <= OUT_BOTH && t->period <= 0xff &&
+	    (max = strobe_limit(t->on, t->period - t->on)) != 0 &&
+	    max != UINT32_MAX && len > (cycles_t)max * t->period)
+		return SCHED_E_TOO_MANY;
+	return 0;
+}
+
+/*
+ * Merge per-channel edges into output steps, carrying on from 'em'.
+ * Edges that fall on the same cycle become a single step. Returns -1 if
+ * the program overflowed.
+ */
+static int
+emit_edges(struct edge *e, size_t n, struct emitter *em)
+{
+	size_t i, j;
+	struct edge tmp;
+	int r;
+
+	/* Insertion sort; there are only ever a handful */
+	for (i = 1; i < n; i++) {
+		for (j = i; j > 0 && e[j - 1].t > e[j].t; j--) {
+			tmp = e[j];
+			e[j] = e[j - 1];
+			e[j - 1] = tmp;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (e[i].on)
+			em->out |= e[i].mask;
+		else
+			em->out &= ~e[i].mask;
+		if (i + 1 < n && e[i + 1].t == e[i].t)
+			continue;
+		if ((r = output_add(em->out, e[i].t - em->last)) == -1)
+			return -1;
+		em->last = e[i].t;
+		em->nsteps = r + 1;
+	}
+	return 0;
+}
+
+/*
+ * Emit the edges of pulse trains 'tr' in frame 'k': the 'frame' cycles
+ * from the start of the first train's pulse k. Only that pulse and the
+ * one before of each train can have edges in it.
+ */
+static int
+emit_frame(const struct train *tr, size_t ntr, cycles_t frame,
+    cycles_t on, uint32_t k, struct emitter *em)
+{
+	struct edge e[6];
+	cycles_t lo = tr[0].start + k * frame, t;
+	size_t i, n = 0;
+	uint32_t j;
+
+	for (i = 0; i < ntr; i++) {
+		for (j = k == 0 ? 0 : k - 1; j <= k && j < tr[i].n; j++) {
+			t = tr[i].start + j * frame;
+			if (t >= lo && t - lo < frame)
+				e[n++] = (struct edge){ t, tr[i].mask, 1 };
+			t += on;
+			if (t >= lo && t - lo < frame)
+				e[n++] = (struct edge){ t, tr[i].mask, 0 };
+		}
+	}
+	return emit_edges(e, n, em);
+}
+
+/*
+ * Emit pulse trains 'tr', which repeat every 'frame' cycles, from one
+ * timeline so the channels can't drift apart. The first frame lacks the
+ * tail of a pulse before it and the last two hold the trains' ends, but
+ * those between are all alike and play as a loop.
+ */
+static int
+emit_frames(const struct train *tr, size_t ntr, cycles_t frame,
+    cycles_t on, struct emitter *em)
+{
+	uint32_t nframes = tr[0].n;
+	uint8_t first;
+
+	if (emit_frame(tr, ntr, frame, on, 0, em) != 0)
+		return -1;
+	if (nframes > 2) {
+		first = em->nsteps;
+		if (emit_frame(tr, ntr, frame, on, 1, em) != 0)
+			return -1;
+		output_repeat(first, nframes - 2);
+		/* Carry on from the loop's last pass */
+		em->last += (nframes - 3) * frame;
+	}
+	if (nframes > 1 &&
+	    emit_frame(tr, ntr, frame, on, nframes - 1, em) != 0)
+		return -1;
+	/* Pulses that run past the end of the last frame */
+	return emit_frame(tr, ntr, frame, on, nframes, em);
+}
+
+static int
+compile_oneshot(const struct config *c, struct schedule *s)
+{
+	struct edge e[4];
+	struct emitter em = { 0, 0, 0 };
+	uint8_t mask = output_masks[c->output];
+	cycles_t wait1, wait2, on;
+	size_t n = 0;
+	int r;
+
+	wait1 = dur_cycles(c->wait, c->wait_unit, NULL);
+	wait2 = dur_cycles(c->wait2, c->wait2_unit, NULL);
+	on = dur_cycles(c->on, c->on_unit, NULL);
+
+	/* Channel 1 fires first; channel 2 follows wait2 later if enabled */
+	if (c->output == OUT_BOTH) {
+		e[n++] = (struct edge){ wait1, CH1, 1 };
+		e[n++] = (struct edge){ wait1 + on, CH1, 0 };
+		e[n++] = (struct edge){ wait1 + wait2, CH2, 1 };
+		e[n++] = (struct edge){ wait1 + wait2 + on, CH2, 0 };
+	} else {
+		e[n++] = (struct edge){ wait1, mask, 1 };
+		e[n++] = (struct edge){ wait1 + on, mask, 0 };
+	}
+	if (emit_edges(e, n, &em) != 0)
+		return -1;
+
+	s->once = c->holdoff == -1;
+	if (!s->once) {
+		r = output_add(0, dur_cycles(c->holdoff, c->holdoff_unit,
+		    NULL));
+		if (r == -1)
+			return -1;
+		s->holdoff_step = r;
+	}
+	return 0;
+}
+
+static int
+compile_strobe(const struct config *c, const struct timing *t,
+    struct schedule *s)
+{
+	struct train tr[2];
+	struct emitter em = { 0, 0, 0 };
+	struct strobe_burst b;
+	cycles_t wait1, duration, p, on, frame, end;
+	uint32_t ncyc;
+	size_t ntr = 1;
+
+	/* If not in manual trigger, require explicit re-arming */
+	s->once = c->trigger[0] != TRIG_MANUAL && c->trigger[1] != TRIG_MANUAL;
+
+	wait1 = dur_cycles(c->wait, c->wait_unit, NULL);
+	duration = dur_cycles(c->len, c->len_unit, NULL);
+	p = t->period;
+	on = t->on;
+	ncyc = duration / p + (duration % p != 0);
+
+	frame = p;
+	tr[0] = (struct train){ wait1, ncyc, CH1 };
+	switch (c->output) {
+	case OUT_ALT:
+		/* Every other pulse moves to CH2, between CH1's */
+		frame = 2 * p;
+		tr[0].n = ncyc - ncyc / 2;
+		tr[1] = (struct train){ wait1 + p, ncyc / 2, CH2 };
+		ntr = 2;
+		break;
+	case OUT_PHASE:
+		tr[1] = (struct train){ wait1 + p * c->phase / PHASE_MAX,
+		    ncyc, CH2 };
+		ntr = 2;
+		break;
+	default:
+		tr[0].mask = output_masks[c->output];
+		/*
+		 * MHz rates have a kernel that plays the strobe exactly;
+		 * schedule_timing() made sure it has room for ncyc.
+		 */
+		if (p <= 0xff && strobe_prepare(on, p - on, ncyc, &b) == 0) {
+			if (output_add_burst(tr[0].mask, 0, wait1, &b) == -1)
+				return -1;
+			em.last = wait1 + b.len;
+			ntr = 0;
+		}
+		break;
+	}
+	if (ntr != 0 && emit_frames(tr, ntr, frame, on, &em) != 0)
+		return -1;
+
+	/* Hold off to the end of the last period */
+	end = wait1 + ncyc * p;
+	if (end > em.last && output_add(0, end - em.last) == -1)
+		return -1;
+	return 0;
+}
+
+int
+schedule_compile(const struct config *c, struct schedule *s)
+{
+	struct timing t;
+
+	s->holdoff_step = 0xff;
+	s->once = 1;
+	output_reset();
+	if (schedule_timing(c, &t) != 0)
+		return -1;
+	switch (c->mode) {
+	case MODE_ONESHOT:
+		return compile_oneshot(c, s);
+	case MODE_STROBE:
+		return compile_strobe(c, &t, s);
+	}
+	return -1;
+}
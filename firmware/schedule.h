@@ -0,0 +1,70 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Schedule compiler: turns the configuration into an output engine
+ * program once, at arm time, so triggering only has to start it.
+ */
+
+#include <stdint.h>
+
+#include "cycles.h"
+#include "ui.h"
+
+struct schedule {
+	uint8_t holdoff_step;	/* Index of the holdoff step or 0xff */
+	uint8_t once;		/* Return to the editor after one run */
+};
+
+/* What the engine will play for a configuration, in CPU cycles */
+struct timing {
+	cycles_t period;	/* Strobe period; 0 for oneshot */
+	cycles_t on;		/* Pulse width... */
+	cycles_t want_on;	/* ...and as requested, before any cut */
+	uint8_t on_exact;	/* want_on needed no rounding */
+	uint32_t freq_ppm;	/* Strobe frequency error, parts per million */
+	uint32_t freq_x10k;	/* Achieved frequency, 10^-4 freq_unit */
+};
+
+/* Problems found by schedule_timing() */
+#define SCHED_OK		0
+#define SCHED_E_OUTPUT		1	/* Bad output selection */
+#define SCHED_E_NO_PULSE	2	/* Pulse width of zero */
+#define SCHED_E_NO_FREQ		3	/* Strobe frequency of zero */
+#define SCHED_E_TOO_FAST	4	/* Strobe period under a cycle */
+#define SCHED_E_TOO_LONG	5	/* A time overflows the engine */
+#define SCHED_E_NO_LENGTH	6	/* Strobe length of zero */
+#define SCHED_E_TOO_MANY	7	/* More pulses than its kernel plays */
+#define SCHED_E_MAX		8
+
+/*
+ * Work out the timing configuration 'c' will produce into 't' without
+ * touching the output engine; cheap enough to run on every edit.
+ * Returns SCHED_OK or the SCHED_E_* problem that rules 'c' out.
+ */
+int schedule_timing(const struct config *c, struct timing *t);
+
+/*
+ * Compile configuration 'c' into the output engine program and fill in
+ * 's'. Returns 0 on success or -1 if the parameters are invalid, i.e. if
+ * schedule_timing() finds a problem.
+ */
+int schedule_compile(const struct config *c, struct schedule *s);
+
+#endif /* SCHEDULE_H */
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Define STATUS_LOCAL_DEBUG for main() that tests on build host, e.g.
+ * gcc -o /tmp/test_status -D STATUS_LOCAL_DEBUG=1 -Wall status.c \
+ *     num_format.c
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lcd.h"
+#include "num_format.h"
+#include "status.h"
+
+/* Append 's' to 'buf', stopping at LCD_COLS */
+static void
+append(char *buf, const char *s)
+{
+	size_t n = strlen(buf);
+
+	while (*s != '\0' && n < LCD_COLS)
+		buf[n++] = *s++;
+	buf[n] = '\0';
+}
+
+/*
+ * Widest is "1000.0kHz 99% +99.9%": six characters of frequency, three
+ * of unit, three of duty and "% +", then the error in at most five.
+ */
+void
+status_strobe(char *buf, uint32_t freq_x10k, const char *unit,
+    uint8_t duty, uint32_t ppm)
+{
+	char nbuf[4];
+	uint32_t v;
+	uint8_t dp;
+
+	*buf = '\0';
+	/* Five significant figures */
+	for (v = freq_x10k, dp = 4; v >= 100000 && dp > 0; dp--)
+		v = (v + 5) / 10;
+	append(buf, ntodp(v, dp));
+	append(buf, unit);
+	/* A pulse is always shorter than its period */
+	if (duty > 99)
+		duty = 99;
+	append(buf, rjustify(ntod(duty), nbuf, sizeof(nbuf)));
+	append(buf, "% +");
+	if (ppm < 1000) {
+		append(buf, ntod(ppm));
+		append(buf, "p");
+	} else {
+		/* Tenths of a percent; the error is always under 100% */
+		append(buf, ntodp(ppm / 1000, 1));
+		append(buf, "%");
+	}
+}
+
+/* Widest is "pulse 999ns ~1000ns" */
+void
+status_pulse(char *buf, int16_t on, const char *unit, uint8_t exact,
+    uint32_t ns)
+{
+	*buf = '\0';
+	append(buf, "pulse ");
+	append(buf, ntod(on));
+	append(buf, unit);
+	if (exact)
+		append(buf, " exact");
+	else {
+		append(buf, " ~");
+		append(buf, ntod(ns));
+		append(buf, "ns");
+	}
+}
+
+#if STATUS_LOCAL_DEBUG
+#include <err.h>
+#include <stdio.h>
+
+/* Fail unless 'buf' fits the row and ends with 'last' */
+static void
+check(int line, const char *buf, char last)
+{
+	size_t l = strlen(buf);
+
+	if (l == 0 || l > LCD_COLS || buf[l - 1] != last)
+		errx(1, "%d: \"%s\" %zu", line, buf, l);
+}
+
+int
+main(void)
+{
+	char buf[LCD_COLS + 1];
+	static const uint32_t freqs[] = {
+		1, 9999, 10000, 99999, 100000, 9990000, 9999999, 10000000,
+		200000000, 999999999,
+	};
+	static const uint32_t ppms[] = { 0, 999, 1000, 99999, 999999 };
+	size_t i, j;
+
+	/* Every frequency against the widest duty and errors */
+	for (i = 0; i < sizeof(freqs) / sizeof(*freqs); i++) {
+		for (j = 0; j < sizeof(ppms) / sizeof(*ppms); j++) {
+			status_strobe(buf, freqs[i], "mHz", 100, ppms[j]);
+			check(__LINE__, buf, ppms[j] < 1000 ? 'p' : '%');
+			status_strobe(buf, freqs[i], "kHz", 0, ppms[j]);
+			check(__LINE__, buf, ppms[j] < 1000 ? 'p' : '%');
+		}
+	}
+	status_strobe(buf, 10000000, "kHz", 100, 999999);
+	if (strcmp(buf, "1000.0kHz 99% +99.9%") != 0)
+		errx(1, "%d: \"%s\"", __LINE__, buf);
+	status_strobe(buf, 100000, "MHz", 50, 12);
+	if (strcmp(buf, "10.000MHz 50% +12p") != 0)
+		errx(1, "%d: \"%s\"", __LINE__, buf);
+
+	/* Pulses */
+	status_pulse(buf, 999, "ns", 0, 1000);
+	check(__LINE__, buf, 's');
+	if (strcmp(buf, "pulse 999ns ~1000ns") != 0)
+		errx(1, "%d: \"%s\"", __LINE__, buf);
+	status_pulse(buf, 999, "s ", 1, 0);
+	check(__LINE__, buf, 't');
+
+	printf("OK\n");
+	return 0;
+}
+#endif /* STATUS_LOCAL_DEBUG */
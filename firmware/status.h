@@ -0,0 +1,46 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The editor's status line: what a configuration will really produce,
+ * formatted to fit the top row of the LCD.
+ *
+ * This has no hardware dependencies so it can be tested on the build host
+ * with STATUS_LOCAL_DEBUG.
+ */
+
+#include <stdint.h>
+
+/*
+ * Format a strobe's achieved frequency 'freq_x10k' (10^-4 of the rate
+ * label 'unit'), its duty cycle in percent and its frequency error in
+ * parts per million into 'buf', which must hold LCD_COLS + 1.
+ */
+void status_strobe(char *buf, uint32_t freq_x10k, const char *unit,
+    uint8_t duty, uint32_t ppm);
+
+/*
+ * Format a oneshot pulse of 'on' 'unit' into 'buf', which must hold
+ * LCD_COLS + 1. If it isn't exact, the nanoseconds 'ns' it rounds to are
+ * shown too.
+ */
+void status_pulse(char *buf, int16_t on, const char *unit, uint8_t exact,
+    uint32_t ns);
+
+#endif /* STATUS_H */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "strobe.h"
+
+/* Written by strobe_gen into strobe_kernels.S */
+extern const struct strobe_kernel strobe_kernels[] PROGMEM;
+
+/* Copy the kernel for an on/off pair into 'k'; -1 if there's none */
+static int
+find_kernel(uint8_t on, uint8_t off, struct strobe_kernel *k)
+{
+	const struct strobe_kernel *p;
+
+	for (p = strobe_kernels; ; p++) {
+		memcpy_P(k, p, sizeof(*k));
+		if (k->on == 0)
+			return -1;
+		if (k->on == on && k->off == off)
+			return 0;
+	}
+}
+
+uint32_t
+strobe_limit(uint8_t on, uint8_t off)
+{
+	struct strobe_kernel k;
+
+	if (find_kernel(on, off, &k) != 0)
+		return 0;
+	return k.k != 0 ? UINT32_MAX : STROBE_UNROLL;
+}
+
+int
+strobe_prepare(uint8_t on, uint8_t off, uint32_t n, struct strobe_burst *b)
+{
+	struct strobe_kernel k;
+	uint8_t period = on + off;
+	uint32_t m, r;
+
+	if (n == 0 || find_kernel(on, off, &k) != 0)
+		return -1;
+	if (k.k != 0 && n - k.phase >= k.k) {
+		/*
+		 * Passes of k periods, the rest played by the prefix. A
+		 * phase 1 prefix also has the first pass's rising edge.
+		 */
+		m = n - k.phase;
+		r = m % k.k;
+		b->entry = k.top - r * period - (k.phase ? on : 0);
+		b->count = m / k.k;
+	} else {
+		/* Enter the straight line n periods from its end */
+		if (n > (k.k != 0 ? k.k : STROBE_UNROLL))
+			return -1;
+		b->entry = k.tail - n * period;
+		b->count = 0;
+	}
+	b->len = (n - 1) * period + on;
+	return 0;
+}
@@ -0,0 +1,101 @@
+#ifndef STROBE_H
+#define STROBE_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Cycle-exact strobe kernels for periods too short for the output engine's
+ * steps, where LONG_WAIT()'s overhead is more than the period itself.
+ *
+ * strobe_gen (a build host program) writes strobe_kernels.S: one kernel
+ * for every on/off pair of a period an n MHz setting can produce, i.e.
+ * F_CPU / (n * 10^6) cycles for n up to STROBE_MAX_MHZ. Each is
+ * straight-line code of "out" and "nop" with the loop counting hidden in
+ * the nops, so every edge lands on its cycle:
+ *
+ *	- Pairs with a gap of at least 2 cycles after one of the edges loop
+ *	  over k periods per pass, with the 32-bit pass counter's
+ *	  subi/sbci/sbci/sbci and the loop's brne placed in the gaps. Bursts
+ *	  that aren't a multiple of k start part-way into a straight-line
+ *	  prefix that runs into the loop; ones shorter than a pass start
+ *	  part-way into k periods of straight-line code after it.
+ *	- Pairs with no such gap (on and off both 1 or 2 cycles) can't hide
+ *	  a branch, so they are STROBE_UNROLL periods of straight-line code
+ *	  entered part-way in. Longer bursts of them can't be played.
+ *
+ * strobe_play() (strobe_play.S) paces to the first edge against Timer1,
+ * like the engine's paced steps, and jumps into the kernel. Interrupts
+ * must be disabled.
+ */
+
+#define STROBE_MAX_MHZ		10
+#define STROBE_UNROLL		64
+
+/*
+ * Cycles from strobe_play()'s counter read to its first edge, less the
+ * nop sled: the same poll as pace_write(), whose short sled lets a
+ * branch reach past it (20), plus 4 to save the sled offset and jump to
+ * the kernel. The sled must be longer than a poll pass (14).
+ */
+#define STROBE_PACE_FIXED	24
+#define STROBE_PACE_SLED	32
+
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+/* A kernel in strobe_kernels[], as written by strobe_gen */
+struct strobe_kernel {
+	uint8_t on, off;	/* Cycles; on == 0 ends the table */
+	uint8_t k;		/* Periods per loop pass; 0 if unrolled */
+	uint8_t phase;		/* Loop pass starts at the falling edge */
+	uint16_t top;		/* Word address of the loop */
+	uint16_t tail;		/* ...and of the end of the straight line */
+};
+
+/* A burst worked out by strobe_prepare() for strobe_play() */
+struct strobe_burst {
+	uint16_t entry;		/* Word address to jump to */
+	uint32_t count;		/* Loop passes */
+	uint32_t len;		/* Cycles from the first edge to the last */
+};
+
+/*
+ * Returns the most pulses 'on' cycles long every 'on' + 'off' cycles that
+ * a kernel can play: STROBE_UNROLL if it's unrolled, UINT32_MAX if it
+ * loops, or 0 if there's no kernel for them.
+ */
+uint32_t strobe_limit(uint8_t on, uint8_t off);
+
+/*
+ * Find the kernel for 'n' pulses 'on' cycles long every 'on' + 'off'
+ * cycles and work out how to play them into 'b'. Returns 0 on success
+ * or -1 if there's no kernel or the burst is too short or long for it.
+ */
+int strobe_prepare(uint8_t on, uint8_t off, uint32_t n,
+    struct strobe_burst *b);
+
+/*
+ * Play burst 'b', writing port value 'on' at each rising edge and 'off'
+ * at each falling one; the first rising edge lands when Timer1 reaches
+ * 't', or at once if that has passed. Returns after the last falling
+ * edge. Interrupts must be disabled.
+ */
+void strobe_play(uint16_t t, uint8_t on, uint8_t off, uint32_t count,
+    uint16_t entry);
+#endif /* __ASSEMBLER__ */
+
+#endif /* STROBE_H */
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Benchmark firmware for the strobe kernels: plays every burst in
+ * strobe_bench.h on PA0. Run it under wait_bench_sim -s ("make
+ * strobe-bench"), which checks each edge lands on its cycle.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+
+#include "strobe.h"
+#include "strobe_bench.h"
+
+/* Cycles from reading the counter to a burst's first edge */
+#define BENCH_LEAD	256
+
+int
+main(void)
+{
+	struct strobe_burst b;
+	uint8_t on, off;
+	uint32_t n;
+	uint16_t i;
+
+	cli();
+	DDRA = (1 << STROBE_BENCH_PIN);
+	PORTA = 0;
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+	for (i = 0; strobe_bench_case(i, &on, &off, &n); i++) {
+		/* A missing kernel stops here; the harness reports it */
+		if (strobe_prepare(on, off, n, &b) != 0)
+			break;
+		strobe_play(TCNT1 + BENCH_LEAD, 1 << STROBE_BENCH_PIN, 0,
+		    b.count, b.entry);
+	}
+	/* Sleeping with interrupts off ends the simulation */
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_enable();
+	sleep_cpu();
+	for (;;)
+		;
+}
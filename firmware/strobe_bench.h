@@ -0,0 +1,68 @@
+#ifndef STROBE_BENCH_H
+#define STROBE_BENCH_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Burst list shared by the strobe_bench firmware and wait_bench_sim -s.
+ * The firmware plays each burst on PA0 with strobe_play(); the harness
+ * checks every pulse's width and the period between them to the cycle.
+ */
+
+#include <stdint.h>
+
+#include "strobe.h"
+
+#define STROBE_BENCH_PIN	0	/* PA0 */
+
+/* Pulses per burst; the longest only for kernels that loop */
+static const uint16_t strobe_bench_lens[] = { 1, 2, 3, 4, 5, 7, 64, 1000 };
+#define STROBE_BENCH_NLENS \
+	(sizeof(strobe_bench_lens) / sizeof(*strobe_bench_lens))
+
+/*
+ * Fill in the 'i'th burst: every on/off pair of each n MHz period, as
+ * strobe_gen covers, at each length. Returns 0 after the last.
+ */
+static inline int
+strobe_bench_case(uint16_t i, uint8_t *on, uint8_t *off, uint32_t *n)
+{
+	uint8_t f, p, last = 0, j, k;
+
+	for (f = 1; f <= STROBE_MAX_MHZ; f++) {
+		if ((p = F_CPU / 1000000 / f) < 2 || p == last)
+			continue;
+		last = p;
+		for (j = 1; j < p; j++) {
+			for (k = 0; k < STROBE_BENCH_NLENS; k++) {
+				/* Unrolled kernels stop at STROBE_UNROLL */
+				if (strobe_bench_lens[k] > STROBE_UNROLL &&
+				    j < 3 && p - j < 3)
+					continue;
+				if (i-- != 0)
+					continue;
+				*on = j;
+				*off = p - j;
+				*n = strobe_bench_lens[k];
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+#endif /* STROBE_BENCH_H */
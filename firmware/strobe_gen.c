@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Writes strobe_kernels.S, the strobe kernels and their table; see
+ * strobe.h. Runs on the build host.
+ *
+ * usage: strobe_gen [-t]
+ *
+ * -t checks every kernel instead: it runs each on a cycle-counting model
+ * of the instructions it's made of, for a range of burst lengths, and
+ * checks every edge lands on its cycle.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "strobe.h"
+
+#define F_MHZ		((int)(F_CPU / 1000000))
+#define MAX_PERIOD	F_MHZ			/* 1MHz */
+#define MAX_INSNS	(2 * STROBE_UNROLL * MAX_PERIOD + 16)
+
+/* The few instructions the kernels are made of */
+enum op { OUT_ON, OUT_OFF, NOP, SUBI, SBCI, BRNE, EXIT };
+
+static const char *const counter_ops[] = {
+	"subi	r16, 1", "sbci	r17, 0", "sbci	r18, 0", "sbci	r19, 0",
+};
+#define NCOUNTER_OPS	(sizeof(counter_ops) / sizeof(*counter_ops))
+
+struct insn {
+	enum op op;
+	uint8_t reg;		/* SUBI/SBCI */
+};
+
+/* A kernel as generated, before it is written out or checked */
+struct kernel {
+	uint8_t on, off, k, phase;
+	struct insn code[MAX_INSNS];
+	size_t n;		/* Instructions */
+	size_t top, tail;	/* Index of the loop and straight line ends */
+};
+
+static void
+emit(struct kernel *kn, enum op op, uint8_t reg)
+{
+	if (kn->n >= MAX_INSNS)
+		errx(1, "kernel %u/%u too long", kn->on, kn->off);
+	kn->code[kn->n].op = op;
+	kn->code[kn->n].reg = reg;
+	kn->n++;
+}
+
+static void
+emit_nops(struct kernel *kn, int n)
+{
+	while (n-- > 0)
+		emit(kn, NOP, 0);
+}
+
+/* One edge and the nops to the next: 'cycles' words and cycles */
+static void
+emit_half(struct kernel *kn, int rising, int cycles)
+{
+	emit(kn, rising ? OUT_ON : OUT_OFF, 0);
+	emit_nops(kn, cycles - 1);
+}
+
+/* 'n' whole periods of straight-line code, entered part-way in */
+static void
+emit_straight(struct kernel *kn, int n)
+{
+	while (n-- > 0) {
+		emit_half(kn, 1, kn->on);
+		emit_half(kn, 0, kn->off);
+	}
+	kn->tail = kn->n;
+	emit(kn, EXIT, 0);
+}
+
+/*
+ * Build the kernel for 'on'/'off'. The gap after an edge is that half
+ * period less the "out". A loop pass needs the counter's four 1-cycle
+ * instructions somewhere and the 2-cycle brne at the end of its last gap.
+ */
+static void
+build(struct kernel *kn, int on, int off)
+{
+	int gap[2], cap, first, last, i, j, g, used, op;
+
+	memset(kn, 0, sizeof(*kn));
+	kn->on = on;
+	kn->off = off;
+	if (off - 1 >= 2)
+		kn->phase = 0;
+	else if (on - 1 >= 2)
+		kn->phase = 1;
+	else {
+		/* No room for a branch anywhere: unrolled */
+		emit_straight(kn, STROBE_UNROLL);
+		kn->top = kn->tail;
+		return;
+	}
+	/* Half periods in pass order; the pass ends in the bigger gap */
+	first = kn->phase == 0 ? on : off;
+	last = kn->phase == 0 ? off : on;
+	gap[0] = first - 1;
+	gap[1] = last - 1;
+	for (kn->k = 1; ; kn->k++) {
+		cap = kn->k * (gap[0] + gap[1]) - 2;
+		if (cap >= (int)NCOUNTER_OPS)
+			break;
+	}
+
+	/* Prefix: k - 1 periods, plus the rising edge for phase 1 */
+	for (i = 0; i < kn->k - 1; i++) {
+		emit_half(kn, 1, on);
+		emit_half(kn, 0, off);
+	}
+	if (kn->phase == 1)
+		emit_half(kn, 1, on);
+	kn->top = kn->n;
+
+	/* The loop pass, counter instructions as early as they fit */
+	op = 0;
+	for (i = 0; i < kn->k; i++) {
+		for (j = 0; j < 2; j++) {
+			emit(kn, (j == 0) == (kn->phase == 0) ?
+			    OUT_ON : OUT_OFF, 0);
+			g = gap[j];
+			if (i == kn->k - 1 && j == 1)
+				g -= 2;
+			for (used = 0; used < g && op < (int)NCOUNTER_OPS;
+			    used++, op++)
+				emit(kn, op == 0 ? SUBI : SBCI, 16 + op);
+			emit_nops(kn, g - used);
+		}
+	}
+	if (op != NCOUNTER_OPS)
+		errx(1, "kernel %u/%u: counter doesn't fit", on, off);
+	emit(kn, BRNE, 0);
+	/* Falling out of the brne is a cycle early; finish the pulse */
+	if (kn->phase == 1) {
+		emit(kn, NOP, 0);
+		emit(kn, OUT_OFF, 0);
+	}
+	emit(kn, EXIT, 0);
+
+	/* Bursts too short for a pass */
+	emit_straight(kn, kn->k);
+}
+
+/* Returns non-zero if some n MHz setting gives a period of 'p' cycles */
+static int
+wanted(int p)
+{
+	int n;
+
+	for (n = 1; n <= STROBE_MAX_MHZ; n++) {
+		if (F_MHZ / n == p)
+			return 1;
+	}
+	return 0;
+}
+
+static void
+write_kernel(const struct kernel *kn)
+{
+	size_t i;
+
+	printf("\n/* on %u off %u: ", kn->on, kn->off);
+	if (kn->k == 0)
+		printf("unrolled %u periods */\n", STROBE_UNROLL);
+	else {
+		printf("%u period%s per pass from the %s edge */\n", kn->k,
+		    kn->k == 1 ? "" : "s", kn->phase ? "falling" : "rising");
+	}
+	for (i = 0; i < kn->n; i++) {
+		if (i == kn->top && kn->k != 0)
+			printf("strobe_top_%u_%u:\n", kn->on, kn->off);
+		if (i == kn->tail)
+			printf("strobe_tail_%u_%u:\n", kn->on, kn->off);
+		switch (kn->code[i].op) {
+		case OUT_ON:
+			printf("\tout\t_SFR_IO_ADDR(OUT_PORT), r22\n");
+			break;
+		case OUT_OFF:
+			printf("\tout\t_SFR_IO_ADDR(OUT_PORT), r20\n");
+			break;
+		case NOP:
+			printf("\tnop\n");
+			break;
+		case SUBI:
+		case SBCI:
+			printf("\t%s\n", counter_ops[kn->code[i].reg - 16]);
+			break;
+		case BRNE:
+			printf("\tbrne\tstrobe_top_%u_%u\n", kn->on, kn->off);
+			break;
+		case EXIT:
+			printf("\tjmp\tstrobe_done\n");
+			break;
+		}
+	}
+}
+
+/*
+ * Run 'kn' for an n pulse burst, as strobe_prepare() would set it up,
+ * on a model that counts cycles, and check every edge.
+ */
+static void
+check(const struct kernel *kn, uint32_t n)
+{
+	uint8_t r[4], c = 0, z = 0, a, port = 0;
+	uint32_t m, rem, cyc = 0, edges = 0, p = kn->on + kn->off, want;
+	size_t pc;
+	int i;
+
+	if (kn->k != 0 && n - kn->phase >= kn->k) {
+		m = n - kn->phase;
+		rem = m % kn->k;
+		m /= kn->k;
+		pc = kn->top - rem * p - (kn->phase ? kn->on : 0);
+	} else {
+		if (n > (kn->k != 0 ? kn->k : STROBE_UNROLL))
+			errx(1, "kernel %u/%u n %u: no entry", kn->on,
+			    kn->off, n);
+		pc = kn->tail - n * p;
+		m = 0;
+	}
+	for (i = 0; i < 4; i++)
+		r[i] = m >> (8 * i);
+
+	for (;;) {
+		const struct insn *in = &kn->code[pc];
+
+		switch (in->op) {
+		case OUT_ON:
+		case OUT_OFF:
+			/* Edge 2i rises at i * p, 2i + 1 falls 'on' later */
+			want = (edges / 2) * p + (edges % 2 ? kn->on : 0);
+			if ((in->op == OUT_ON) != (edges % 2 == 0) ||
+			    cyc != want)
+				errx(1, "kernel %u/%u n %u: edge %u at %u, "
+				    "want %u", kn->on, kn->off, n, edges, cyc,
+				    want);
+			port = in->op == OUT_ON;
+			edges++;
+			cyc++;
+			pc++;
+			break;
+		case NOP:
+			cyc++;
+			pc++;
+			break;
+		case SUBI:
+		case SBCI:
+			a = r[in->reg - 16];
+			if (in->op == SUBI) {
+				r[0] = a - 1;
+				c = a < 1;
+				z = r[0] == 0;
+			} else {
+				r[in->reg - 16] = a - c;
+				c = a < c;
+				z = z && r[in->reg - 16] == 0;
+			}
+			cyc++;
+			pc++;
+			break;
+		case BRNE:
+			if (!z) {
+				cyc += 2;
+				pc = kn->top;
+			} else {
+				cyc++;
+				pc++;
+			}
+			break;
+		case EXIT:
+			if (edges != 2 * n || port != 0)
+				errx(1, "kernel %u/%u n %u: %u edges", kn->on,
+				    kn->off, n, edges);
+			return;
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct kernel kn;
+	int ch, test = 0, p, on;
+	uint32_t n;
+
+	while ((ch = getopt(argc, argv, "t")) != -1) {
+		switch (ch) {
+		case 't':
+			test = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: strobe_gen [-t]\n");
+			exit(1);
+		}
+	}
+
+	if (!test) {
+		printf("/* Generated by strobe_gen for F_CPU %lu; "
+		    "do not edit */\n\n", (unsigned long)F_CPU);
+		printf("#include <avr/io.h>\n\n#include \"output.h\"\n"
+		    "#include \"strobe.h\"\n\n\t.text\n");
+	}
+	for (p = 2; p <= MAX_PERIOD; p++) {
+		if (!wanted(p))
+			continue;
+		for (on = 1; on < p; on++) {
+			build(&kn, on, p - on);
+			if (!test) {
+				write_kernel(&kn);
+				continue;
+			}
+			for (n = 1; n <= STROBE_UNROLL; n++)
+				check(&kn, n);
+			if (kn.k == 0)
+				continue;
+			check(&kn, 1000);
+			check(&kn, 65537);
+		}
+	}
+	if (test) {
+		printf("OK\n");
+		return 0;
+	}
+
+	printf("\n\t.section .progmem.data,\"a\",@progbits\n"
+	    "\t.global strobe_kernels\nstrobe_kernels:\n");
+	for (p = 2; p <= MAX_PERIOD; p++) {
+		if (!wanted(p))
+			continue;
+		for (on = 1; on < p; on++) {
+			build(&kn, on, p - on);
+			printf("\t.byte\t%u, %u, %u, %u\n", kn.on, kn.off,
+			    kn.k, kn.phase);
+			printf("\t.word\tgs(strobe_%s_%u_%u), "
+			    "gs(strobe_tail_%u_%u)\n", kn.k ? "top" : "tail",
+			    kn.on, kn.off, kn.on, kn.off);
+		}
+	}
+	printf("\t.byte\t0, 0, 0, 0\n\t.word\t0, 0\n");
+	return 0;
+}
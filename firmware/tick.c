@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdint.h>
+
+#include "input.h"
+#include "tick.h"
+
+static volatile uint16_t ticks;
+
+ISR(TIMER2_COMPA_vect)
+{
+	static uint8_t samples;
+
+	input_sample();
+	if (++samples == TICK_SAMPLE_HZ / TICK_HZ) {
+		samples = 0;
+		ticks++;
+	}
+}
+
+void
+tick_setup(void)
+{
+	TIMSK2 = 0;
+	TCCR2A = (1 << WGM21); /* CTC */
+	TCCR2B = (1 << CS21) | (1 << CS20); /* clk/32 */
+	OCR2A = (F_CPU / TICK_PRESCALE / TICK_SAMPLE_HZ) - 1;
+	TCNT2 = 0;
+	tick_enable(1);
+}
+
+void
+tick_enable(int on)
+{
+	if (on) {
+		TIFR2 = (1 << OCF2A);
+		TIMSK2 |= (1 << OCIE2A);
+	} else
+		TIMSK2 &= ~(1 << OCIE2A);
+}
+
+uint16_t
+tick_now(void)
+{
+	uint16_t r;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		r = ticks;
+	}
+	return r;
+}
@@ -0,0 +1,45 @@
+#ifndef TICK_H
+#define TICK_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Millisecond system tick from Timer2 in CTC mode. The interrupt runs at
+ * TICK_SAMPLE_HZ to sample the front panel inputs (input.c) and counts
+ * milliseconds every TICK_SAMPLE_HZ / TICK_HZ samples.
+ *
+ * The tick interrupt would add jitter to the output engine's edges, so
+ * it is stopped while a program is armed or running; tick_now() does
+ * not advance and the inputs are not sampled meanwhile.
+ */
+
+#include <stdint.h>
+
+#define TICK_HZ			1000
+#define TICK_SAMPLE_HZ		4000
+#define TICK_PRESCALE		32
+
+/* Setup and start the tick */
+void tick_setup(void);
+
+/* Start or stop the tick interrupt */
+void tick_enable(int on);
+
+/* Returns the current tick count; wraps every ~65 seconds */
+uint16_t tick_now(void);
+
+#endif /* TICK_H */
@@ -0,0 +1,450 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "ui.h"
+#include "output.h"
+#include "trigger.h"
+
+/* Trigger table; aligned so an index can be OR-ed into its address */
+static uint8_t trig_lut[TRIG_LUT_SIZE] __attribute__((aligned(TRIG_LUT_SIZE)));
+
+/*
+ * Input bits for edge mode, indexed by the previous and current input
+ * pins and whether PCIF0 was latched: (pulse << 4) | (prev << 2) | cur.
+ * Inputs in edge mode read as active when an edge in their direction
+ * happened; level mode inputs pass through. A latched change with the
+ * same level either side was a pulse too short to see, which has both
+ * edges. Aligned like trig_lut.
+ */
+#define EDGE_LUT_PULSE		0x10
+#define EDGE_LUT_SIZE		32
+static uint8_t edge_lut[EDGE_LUT_SIZE]
+    __attribute__((aligned(EDGE_LUT_SIZE)));
+
+static uint8_t used_inputs;	/* TRIG_IDX_IN* bits used by the expression */
+static uint8_t edge_inputs;	/* ... of those in edge mode */
+static uint8_t last_idx;	/* Pins at the last evaluation */
+static uint8_t last_r;		/* Table result at the last evaluation */
+static volatile uint16_t n_detected, n_fired;
+
+/* Returns the TRIG_IDX_IN* bit for input 'mode' uses or 0 if none */
+static uint8_t
+input_bit(int mode)
+{
+	switch (mode) {
+	case TRIG_CHAN_1:
+	case TRIG_CHAN_1_NOT:
+	case TRIG_CHAN_1_RISE:
+	case TRIG_CHAN_1_FALL:
+	case TRIG_CHAN_1_EDGE:
+		return TRIG_IDX_IN1;
+	case TRIG_CHAN_2:
+	case TRIG_CHAN_2_NOT:
+	case TRIG_CHAN_2_RISE:
+	case TRIG_CHAN_2_FALL:
+	case TRIG_CHAN_2_EDGE:
+		return TRIG_IDX_IN2;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Returns non-zero if the edge from pin level 'prev' to 'cur' matches
+ * edge mode 'mode'. NB. inputs are active-low, so a rising input is a
+ * falling pin.
+ */
+static uint8_t
+edge_matches(int mode, uint8_t prev, uint8_t cur)
+{
+	switch (mode) {
+	case TRIG_CHAN_1_RISE:
+	case TRIG_CHAN_2_RISE:
+		return prev && !cur;
+	case TRIG_CHAN_1_FALL:
+	case TRIG_CHAN_2_FALL:
+		return !prev && cur;
+	case TRIG_CHAN_1_EDGE:
+	case TRIG_CHAN_2_EDGE:
+		return prev != cur;
+	default:
+		return 0;
+	}
+}
+
+/* Evaluate one trigger input against snapshot index 'idx' */
+static uint8_t
+evaluate_input(int mode, uint8_t idx)
+{
+	switch (mode) {
+	case TRIG_CHAN_1:
+	case TRIG_CHAN_1_RISE:
+	case TRIG_CHAN_1_FALL:
+	case TRIG_CHAN_1_EDGE:
+		return (idx & TRIG_IDX_IN1) == 0;
+	case TRIG_CHAN_1_NOT:
+		return (idx & TRIG_IDX_IN1) != 0;
+	case TRIG_CHAN_2:
+	case TRIG_CHAN_2_RISE:
+	case TRIG_CHAN_2_FALL:
+	case TRIG_CHAN_2_EDGE:
+		return (idx & TRIG_IDX_IN2) == 0;
+	case TRIG_CHAN_2_NOT:
+		return (idx & TRIG_IDX_IN2) != 0;
+	case TRIG_MANUAL:
+		return (idx & TRIG_IDX_MANUAL) == 0;
+	case TRIG_NONE:
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Work out the inputs used by the expression in 'c' and which of them
+ * are edge-triggered. Returns -1 if an input is used as both an edge and
+ * a level, or if an edge input shares the expression with another input:
+ * both inputs latch the same pin change flag, so a pulse too short to
+ * see could have been on either.
+ */
+static int
+trigger_inputs_of(const struct config *c, uint8_t *used, uint8_t *edges)
+{
+	uint8_t i, b, nterms;
+	int mode;
+
+	nterms = c->combine == COMBINE_NONE ? 1 : 2;
+	*used = *edges = 0;
+	for (i = 0; i < nterms; i++) {
+		mode = c->trigger[i];
+		b = input_bit(mode);
+		*used |= b;
+		if (edge_matches(mode, 1, 0) || edge_matches(mode, 0, 1))
+			*edges |= b;
+	}
+	/* An input can't be used as both an edge and a level */
+	for (i = 0; i < nterms; i++) {
+		mode = c->trigger[i];
+		b = input_bit(mode);
+		if ((*edges & b) != 0 &&
+		    !edge_matches(mode, 1, 0) && !edge_matches(mode, 0, 1))
+			return -1;
+	}
+	/* An edge input must be the only one */
+	if (*edges != 0 && (*used != *edges || *edges == TRIG_IDX_INPUTS))
+		return -1;
+	return 0;
+}
+
+int
+trigger_check(const struct config *c)
+{
+	uint8_t used, edges;
+
+	return trigger_inputs_of(c, &used, &edges);
+}
+
+int
+trigger_arm(const struct config *c)
+{
+	uint8_t idx, i, b, v1, v2, r, nterms;
+	int mode;
+
+	nterms = c->combine == COMBINE_NONE ? 1 : 2;
+	if (trigger_inputs_of(c, &used_inputs, &edge_inputs) != 0)
+		return -1;
+
+	for (idx = 0; idx < EDGE_LUT_SIZE; idx++) {
+		r = idx & 0x03;
+		if ((idx & EDGE_LUT_PULSE) != 0 &&
+		    ((idx >> 2) & 0x03) == (idx & 0x03)) {
+			/* trigger_inputs_of() allows only one edge input */
+			edge_lut[idx] = r & ~edge_inputs;
+			continue;
+		}
+		for (i = 0; i < nterms; i++) {
+			mode = c->trigger[i];
+			b = input_bit(mode);
+			if ((edge_inputs & b) == 0)
+				continue;
+			if (edge_matches(mode, (idx >> 2) & b, idx & b))
+				r &= ~b;
+			else
+				r |= b;
+		}
+		edge_lut[idx] = r;
+	}
+
+	for (idx = 0; idx < TRIG_LUT_SIZE; idx++) {
+		if ((idx & TRIG_IDX_ENC_BUTTON) == 0) {
+			trig_lut[idx] = TRIG_LUT_ABORT;
+			continue;
+		}
+		v1 = evaluate_input(c->trigger[0], idx);
+		v2 = evaluate_input(c->trigger[1], idx);
+		switch (c->combine) {
+		case COMBINE_OR:
+			r = v1 || v2;
+			break;
+		case COMBINE_AND:
+			r = v1 && v2;
+			break;
+		case COMBINE_XOR:
+			r = v1 ^ v2;
+			break;
+		case COMBINE_NONE:
+		default:
+			r = v1;
+			break;
+		}
+		trig_lut[idx] = r ? TRIG_LUT_FIRE : TRIG_LUT_IDLE;
+	}
+
+	/* Latch changes on the inputs in use; see trigger_eval() */
+	PCMSK0 = (PCMSK0 & ~((1 << PCINT4) | (1 << PCINT5))) |
+	    ((used_inputs & TRIG_IDX_IN1) ? (1 << PCINT4) : 0) |
+	    ((used_inputs & TRIG_IDX_IN2) ? (1 << PCINT5) : 0);
+	n_detected = n_fired = 0;
+	return 0;
+}
+
+uint8_t
+trigger_inputs(void)
+{
+	return used_inputs;
+}
+
+uint16_t
+trigger_latency(void)
+{
+	return edge_inputs == 0 ?
+	    TRIGGER_LATENCY_CYCLES : TRIGGER_EDGE_LATENCY_CYCLES;
+}
+
+/* Snapshot the trigger pins as a table index */
+static inline uint8_t
+trigger_index(void)
+{
+	uint8_t a = PINA;
+
+	return ((a >> 4) & TRIG_IDX_INPUTS) |
+	    (PINB & (TRIG_IDX_ENC_BUTTON | TRIG_IDX_MANUAL));
+}
+
+/*
+ * Evaluate the trigger after pin change flags 'flags' were latched,
+ * clearing them afterwards if 'clear' is set.
+ */
+static uint8_t
+trigger_eval(uint8_t flags, uint8_t clear)
+{
+	uint8_t idx, in, raw;
+
+	idx = trigger_index();
+	if (clear)
+		PCIFR = flags;
+	in = edge_lut[((flags & (1 << PCIF0)) != 0 ? EDGE_LUT_PULSE : 0) |
+	    ((last_idx & TRIG_IDX_INPUTS) << 2) | (idx & TRIG_IDX_INPUTS)] |
+	    (idx & (TRIG_IDX_ENC_BUTTON | TRIG_IDX_MANUAL));
+	raw = trig_lut[in];
+	last_idx = idx;
+	/* Edges fire every time; levels only when they become true */
+	if (raw == TRIG_LUT_FIRE && edge_inputs == 0 &&
+	    last_r == TRIG_LUT_FIRE)
+		return TRIG_LUT_IDLE;
+	last_r = raw;
+	return raw;
+}
+
+/* Count triggers that arrive while the output program is busy */
+ISR(PCINT0_vect)
+{
+	if (trigger_eval(1 << PCIF0, 0) == TRIG_LUT_FIRE)
+		n_detected++;
+}
+
+void
+trigger_monitor(int on)
+{
+	if (on) {
+		PCICR |= (1 << PCIE0);
+		return;
+	}
+	/* Count anything latched while edges were pending */
+	cli();
+	if ((PCIFR & (1 << PCIF0)) != 0 &&
+	    trigger_eval(1 << PCIF0, 1) == TRIG_LUT_FIRE)
+		n_detected++;
+	PCICR &= ~(1 << PCIE0);
+	sei();
+}
+
+void
+trigger_counts(uint16_t *detected, uint16_t *fired)
+{
+	cli();
+	*detected = n_detected;
+	*fired = n_fired;
+	sei();
+}
+
+/*
+ * Poll the level-mode trigger table. Returns the table result that
+ * ended the wait.
+ */
+static uint8_t
+wait_levels(void)
+{
+	uint8_t r, tmp;
+
+	/* The expression must be false first, so a held input can't refire */
+	while ((r = trig_lut[trigger_index()]) == TRIG_LUT_FIRE)
+		;
+	if (r == TRIG_LUT_ABORT)
+		return r;
+	/*
+	 * Hot loop: one snapshot, one table load and one branch per
+	 * pass. On a hit it does output_fire()'s port write and timer
+	 * start directly. Cycle counts are in trigger.h.
+	 */
+	__asm__ volatile (
+		"1:"				"\n\t"
+		"in	%[r], %[pina]"		"\n\t"
+		"in	%[tmp], %[pinb]"	"\n\t"
+		"swap	%[r]"			"\n\t"
+		"andi	%[r], %[inmask]"	"\n\t"
+		"andi	%[tmp], %[pbmask]"	"\n\t"
+		"or	%[r], %[tmp]"		"\n\t"
+		"movw	r30, %[lut]"		"\n\t"
+		"or	r30, %[r]"		"\n\t"
+		"ld	%[r], Z"		"\n\t"
+		"tst	%[r]"			"\n\t"
+		"breq	1b"			"\n\t"
+		"sbrc	%[r], 7"		"\n\t"
+		"rjmp	2f"			"\n\t"
+		"out	%[port], %[lead]"	"\n\t"
+		"sts	%[tccr1b], %[cs]"	"\n\t"
+		"2:"				"\n\t"
+		: [r] "=&d" (r), [tmp] "=&d" (tmp)
+		: [pina] "I" (_SFR_IO_ADDR(PINA)),
+		  [pinb] "I" (_SFR_IO_ADDR(PINB)),
+		  [port] "I" (_SFR_IO_ADDR(OUT_PORT)),
+		  [tccr1b] "n" (_SFR_MEM_ADDR(TCCR1B)),
+		  [inmask] "M" (TRIG_IDX_INPUTS),
+		  [pbmask] "M" (TRIG_IDX_ENC_BUTTON | TRIG_IDX_MANUAL),
+		  [lut] "x" (trig_lut),
+		  [lead] "r" (output_lead_out),
+		  [cs] "r" ((uint8_t)(1 << CS10))
+		: "r30", "r31", "memory"
+	);
+	return r;
+}
+
+/*
+ * Wait for an edge-mode trigger. Pin changes are latched by the pin
+ * change flags, so pulses shorter than the loop are never lost.
+ */
+static uint8_t
+wait_edges(void)
+{
+	uint8_t r, f, a, b, prev;
+
+	PCIFR = (1 << PCIF0) | (1 << PCIF1);
+	prev = (trigger_index() & TRIG_IDX_INPUTS) << 2;
+	/*
+	 * Hot loop: poll the flags and, once one is set, clear it and do
+	 * trigger_eval() with one snapshot, the edge table and the trigger
+	 * table. On a hit it does output_fire()'s port write and timer
+	 * start directly, as wait_levels() does. 'prev' holds the last
+	 * pins as an edge_lut index and gets PCIF0 as EDGE_LUT_PULSE.
+	 * Cycle counts are in trigger.h.
+	 */
+	__asm__ volatile (
+		"1:"				"\n\t"
+		"in	%[f], %[pcifr]"		"\n\t"
+		"andi	%[f], %[fmask]"		"\n\t"
+		"breq	1b"			"\n\t"
+		"in	%[a], %[pina]"		"\n\t"
+		"in	%[b], %[pinb]"		"\n\t"
+		"out	%[pcifr], %[f]"		"\n\t"
+		"swap	%[a]"			"\n\t"
+		"andi	%[a], %[inmask]"	"\n\t"
+		"andi	%[b], %[pbmask]"	"\n\t"
+		"bst	%[f], %[pcif0]"		"\n\t"
+		"bld	%[prev], 4"		"\n\t"
+		"movw	r30, %[elut]"		"\n\t"
+		"or	r30, %[prev]"		"\n\t"
+		"or	r30, %[a]"		"\n\t"
+		"ld	%[r], Z"		"\n\t"
+		"or	%[r], %[b]"		"\n\t"
+		"movw	r30, %[lut]"		"\n\t"
+		"or	r30, %[r]"		"\n\t"
+		"ld	%[r], Z"		"\n\t"
+		"sbrs	%[r], 0"		"\n\t"
+		"rjmp	3f"			"\n\t"
+		"out	%[port], %[lead]"	"\n\t"
+		"sts	%[tccr1b], %[cs]"	"\n\t"
+		"rjmp	2f"			"\n\t"
+		"3:"				"\n\t"
+		"mov	%[prev], %[a]"		"\n\t"
+		"lsl	%[prev]"		"\n\t"
+		"lsl	%[prev]"		"\n\t"
+		"tst	%[r]"			"\n\t"
+		"breq	1b"			"\n\t"
+		"2:"				"\n\t"
+		: [r] "=&r" (r), [f] "=&d" (f), [a] "=&d" (a), [b] "=&d" (b),
+		  [prev] "+r" (prev)
+		: [pcifr] "I" (_SFR_IO_ADDR(PCIFR)),
+		  [pina] "I" (_SFR_IO_ADDR(PINA)),
+		  [pinb] "I" (_SFR_IO_ADDR(PINB)),
+		  [port] "I" (_SFR_IO_ADDR(OUT_PORT)),
+		  [tccr1b] "n" (_SFR_MEM_ADDR(TCCR1B)),
+		  [fmask] "M" ((1 << PCIF0) | (1 << PCIF1)),
+		  [pcif0] "I" (PCIF0),
+		  [inmask] "M" (TRIG_IDX_INPUTS),
+		  [pbmask] "M" (TRIG_IDX_ENC_BUTTON | TRIG_IDX_MANUAL),
+		  [elut] "w" (edge_lut),
+		  [lut] "x" (trig_lut),
+		  [lead] "r" (output_lead_out),
+		  [cs] "r" ((uint8_t)(1 << CS10))
+		: "r30", "r31", "memory"
+	);
+	return r;
+}
+
+int
+trigger_wait(void)
+{
+	uint8_t r;
+
+	cli();
+	r = edge_inputs == 0 ? wait_levels() : wait_edges();
+	if (r == TRIG_LUT_FIRE) {
+		if (output_lead_busy)
+			output_lead();
+		n_detected++;
+		n_fired++;
+		/* Don't count the firing edge again in trigger_monitor() */
+		PCIFR = (1 << PCIF0);
+		last_idx = trigger_index();
+		last_r = TRIG_LUT_FIRE;
+	}
+	sei();
+	return r == TRIG_LUT_FIRE;
+}
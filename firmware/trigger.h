@@ -0,0 +1,140 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Trigger input evaluation */
+
+#include <stdint.h>
+
+#include "ui.h"
+
+/*
+ * The trigger expression is compiled into a 16-entry table indexed by a
+ * snapshot of the relevant pins, read back-to-back from PINA and PINB:
+ *
+ *	bit 0	PA4	input 1
+ *	bit 1	PA5	input 2
+ *	bit 2	PB2	encoder button (aborts)
+ *	bit 3	PB3	manual button
+ *
+ * All are active-low. Both trigger inputs come from the same PINA read,
+ * so the expression always sees one consistent input state.
+ */
+#define TRIG_IDX_IN1		0x01
+#define TRIG_IDX_IN2		0x02
+#define TRIG_IDX_ENC_BUTTON	0x04
+#define TRIG_IDX_MANUAL		0x08
+#define TRIG_IDX_INPUTS		(TRIG_IDX_IN1 | TRIG_IDX_IN2)
+#define TRIG_LUT_SIZE		16
+
+/* Table values */
+#define TRIG_LUT_IDLE		0x00
+#define TRIG_LUT_FIRE		0x01
+#define TRIG_LUT_ABORT		0x80
+
+/*
+ * Trigger latency at 20 MHz, in CPU cycles.
+ *
+ * While armed the CPU polls the inputs with interrupts disabled rather
+ * than sleeping until a pin change interrupt: waking from idle and
+ * entering an interrupt handler alone costs 11 cycles before the first
+ * instruction. The latency depends only on whether any input is in edge
+ * mode, not on the inputs or combine operator.
+ *
+ * Both hot loops are written in assembly so the instruction counts are
+ * exact; the input synchroniser and pin change flag delays are from the
+ * datasheet. Level triggers poll the table directly:
+ *
+ *	input synchroniser			0.5-1.5
+ *	wait for the next snapshot		0-12 (13 cycle pass)
+ *	snapshot and index (8), table load (2),
+ *	tst, breq, sbrc skipping rjmp (4)	14
+ *	first port write			1
+ *	timer start				2
+ *
+ * so an immediate first edge is written 22 cycles (1.1us) after the input
+ * on average and 28.5 (1.43us) at worst.
+ *
+ * Edge triggers poll the pin change flags, which latch any change
+ * however short, then evaluate the edge and trigger tables:
+ *
+ *	input synchroniser and flag		3
+ *	wait for the next flag read		0-3 (4 cycle pass)
+ *	flag read, andi, breq (3), snapshot, flag
+ *	clear and edge index (11), edge table load
+ *	(2), index (3), trigger table load (2),
+ *	sbrs skipping rjmp (2)			23
+ *	first port write			1
+ *	timer start				2
+ *
+ * so the first edge comes 28.5 cycles (1.43us) after the input on average
+ * and 30 (1.5us) at worst.
+ *
+ * Neither meets the 1us first edge that was the goal; that needs a loop
+ * that doesn't read and combine both ports every pass. "make
+ * latency-bench" measures both in simavr, which has no synchroniser
+ * delay, so it should report about a cycle less than the above.
+ *
+ * TRIGGER_LATENCY_CYCLES and TRIGGER_EDGE_LATENCY_CYCLES are the means
+ * from the input edge to the output engine's timer starting; the right
+ * one is passed to output_arm() so it comes off the initial delay.
+ */
+#define TRIGGER_POLL_CYCLES		13
+#define TRIGGER_EDGE_POLL_CYCLES	4
+#define TRIGGER_LATENCY_CYCLES \
+	(1 + TRIGGER_POLL_CYCLES / 2 + 14 + 1 + 2)
+#define TRIGGER_EDGE_LATENCY_CYCLES \
+	(3 + TRIGGER_EDGE_POLL_CYCLES / 2 + 23 + 1 + 2)
+
+/*
+ * Returns 0 if trigger_arm() would accept the trigger expression in 'c'
+ * or -1 if not; changes nothing.
+ */
+int trigger_check(const struct config *c);
+
+/*
+ * Compile the trigger expression from configuration 'c' and reset the
+ * trigger counts. Returns -1 if the expression is invalid.
+ */
+int trigger_arm(const struct config *c);
+
+/* Returns the TRIG_IDX_IN* inputs used by the armed expression */
+uint8_t trigger_inputs(void);
+
+/* Returns the trigger latency to pass to output_arm() */
+uint16_t trigger_latency(void);
+
+/*
+ * Wait for the armed trigger expression to become true and fire the
+ * armed output program. Returns 1 if it fired or 0 if the encoder button
+ * was pressed instead.
+ */
+int trigger_wait(void);
+
+/*
+ * Turn counting of triggers that arrive while the output program is
+ * running on or off. Turning it on before all edges are played would
+ * disturb their timing; changes latched meanwhile are counted (once) on
+ * the way off.
+ */
+void trigger_monitor(int on);
+
+/* Return the number of triggers detected and fired since trigger_arm() */
+void trigger_counts(uint16_t *detected, uint16_t *fired);
+
+#endif /* TRIGGER_H */
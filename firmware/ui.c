@@ -16,6 +16,7 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <avr/sleep.h>
 #include <util/delay.h>
 #include <stddef.h>
@@ -28,65 +29,102 @@
 #include "event.h"
 #include "event-types.h"
 #include "ui.h"
+#include "persist.h"
+#include "tick.h"
+#include "wait.h"
+#include "cycles.h"
+#include "schedule.h"
+#include "status.h"
+#include "trigger.h"
 
+/*
+ * The tables below live in flash and are read with pgm_read_byte() and
+ * memcpy_P(); none of them takes any RAM.
+ */
 
+#define SEL_LABEL_LEN	8
 struct selection {
-	size_t n;
-	size_t width;
-	const char *labels[];
+	uint8_t n;
+	uint8_t width;
+	char labels[][SEL_LABEL_LEN];
 };
 
-static const struct selection modes = {
+static const struct selection modes PROGMEM = {
 	MODE_MAX, 7, { "oneshot", "strobe" }
 };
 
-static const struct selection ready = {
+static const struct selection ready PROGMEM = {
 	READY_MAX, 7, { "ready", "*READY*" }
 };
 
-static const struct selection triggers = {
-	TRIG_MAX, 2, { "", "1", "!1", " 2", "!2", "M" }
+static const struct selection triggers PROGMEM = {
+	TRIG_MAX, 2, {
+		"", "1", "!1", " 2", "!2", "M",
+		"1+", "1-", "1~", "2+", "2-", "2~",
+	}
 };
 
-static const struct selection outputs = {
-	OUT_MAX, 4, { "1", "2", "both" }
+/* OUT_PHASE is drawn as its lag instead, e.g. "+25%" */
+static const struct selection outputs PROGMEM = {
+	OUT_PHASE, 4, { "1", "2", "both", "alt" }
 };
 
-static const struct selection combines = {
+static const struct selection combines PROGMEM = {
 	COMBINE_MAX, 1, { "", "|", "&", "^" }
 };
 
-static const struct selection durations = {
-	DUR_MAX, 2, { "\xe4s", "ms", "s " }
+static const struct selection durations PROGMEM = {
+	DUR_MAX, 2, { "ns", "\xe4s", "ms", "s ", "m ", "h " }
 };
 
-static const struct selection rates = {
+static const struct selection rates PROGMEM = {
 	RATE_MAX, 3, { "MHz", "kHz", "Hz ", "mHz" }
 };
 
-static const struct config default_config = {
-	MODE_STROBE,
-	READY_NO,
+static const struct config default_config PROGMEM = {
+	.version = CONFIG_VERSION,
+	.mode = MODE_STROBE,
+	.ready = READY_NO,
 	/* Trigger */
-	{ TRIG_MANUAL, TRIG_NONE }, COMBINE_NONE,
+	.trigger = { TRIG_MANUAL, TRIG_NONE }, .combine = COMBINE_NONE,
 	/* Output */
-	OUT_CH1,
+	.output = OUT_CH1,
 	/* Delay */
-	100, DUR_MILLISEC,
+	.wait = 100, .wait_unit = DUR_MILLISEC,
 	/* 2nd output delay */
-	200, DUR_MILLISEC,
+	.wait2 = 200, .wait2_unit = DUR_MILLISEC,
 	/* On duration */
-	1, DUR_MICROSEC,
+	.on = 1, .on_unit = DUR_MICROSEC,
 	/* Strobe: freq */
-	10, RATE_HZ,
+	.freq = 10, .freq_unit = RATE_HZ,
 	/* Strobe: length */
-	10, DUR_SEC,
+	.len = 10, .len_unit = DUR_SEC,
 	/* Oneshot: holdoff time */
-	2, DUR_SEC,
+	.holdoff = 2, .holdoff_unit = DUR_SEC,
 };
 
 struct config cfg;
 
+/*
+ * Result of checking cfg after each change: a SCHED_E_* problem or
+ * PROBLEM_TRIGGER, and the timing it will produce if there's none.
+ */
+#define PROBLEM_TRIGGER		SCHED_E_MAX
+static uint8_t problem;
+static struct timing timing;
+
+static const char problems[][LCD_COLS + 1] PROGMEM = {
+	"",			/* SCHED_OK */
+	"! bad output",		/* SCHED_E_OUTPUT */
+	"! pulse width is 0",	/* SCHED_E_NO_PULSE */
+	"! frequency is 0",	/* SCHED_E_NO_FREQ */
+	"! frequency too high",	/* SCHED_E_TOO_FAST */
+	"! time too long",	/* SCHED_E_TOO_LONG */
+	"! strobe length is 0",	/* SCHED_E_NO_LENGTH */
+	"! too many pulses",	/* SCHED_E_TOO_MANY */
+	"! edge must be alone",	/* PROBLEM_TRIGGER */
+};
+
 /* Identifiers for UI inputs */
 enum control_id {
 	C_MODE,
@@ -113,14 +151,14 @@ enum control_type {
  * UI element and layout/editing information
  * NB. must be increasing X, Y order.
  */
+#define CTRL_LABEL_LEN	6
 struct control {
 	int x, y;
 	int id;
 	int type;
 	size_t int_width;
-	char *label;
-	int *value;
-	const struct selection *selection;
+	char label[CTRL_LABEL_LEN];
+	const struct selection *selection;	/* In flash */
 };
 
 /* XXX make width mandatory for selectors? everything? */
@@ -137,31 +175,31 @@ struct control {
  */
 #define NUM_CONTROLS_ONESHOT		21
 #define CONTROL_ONESHOT_STARTPOS	2 /* ready */
-static const struct control oneshot_controls[NUM_CONTROLS_ONESHOT] = {
-	{ 0,  0, -1,		I_LAB, 0, "Mode:", NULL, NULL },
-	{ 5,  0, C_MODE,	I_SEL, 0, NULL, &cfg.mode, &modes },
-	{ 13, 0, C_READY,	I_SEL, 0, NULL, &cfg.ready, &ready },
-
-	{ 0,  1, -1,		I_LAB, 0, "TRIG:", NULL, NULL },
-	{ 5,  1, C_TRIG_IN1,	I_SEL, 0, NULL, &cfg.trigger[0], &triggers },
-	{ 7,  1, C_TRIG_COMBINE,I_SEL, 0, NULL, &cfg.combine, &combines },
-	{ 8,  1, C_TRIG_IN2,	I_SEL, 0, NULL, &cfg.trigger[1], &triggers },
-	{ 12, 1, -1,		I_LAB, 0, "Out:", NULL, NULL },
-	{ 16, 1, C_OUTPUT,	I_SEL, 0, NULL, &cfg.output, &outputs },
-
-	{ 0,  2, -1,		I_LAB, 0, "Wait:", NULL, NULL },
-	{ 5,  2, C_WAIT,	I_INT, 3, NULL, &cfg.wait, NULL },
-	{ 8,  2, C_WAIT_U,	I_SEL, 0, NULL, &cfg.wait_unit, &durations },
-	{ 11, 2, -1,		I_LAB, 0, "CH2:", NULL, NULL },
-	{ 15, 2, C_WAIT2,	I_INT, 3, NULL, &cfg.wait2, NULL },
-	{ 18, 2, C_WAIT2_U,	I_SEL, 0, NULL, &cfg.wait2_unit, &durations },
-
-	{ 0,  3, -1,		I_LAB, 0, "Dur:", NULL, NULL },
-	{ 4,  3, C_ON,		I_INT, 3, NULL, &cfg.on, NULL },
-	{ 7,  3, C_ON_U,	I_SEL, 0, NULL, &cfg.on_unit, &durations },
-	{ 10, 3, -1,		I_LAB, 0, "Hold:", NULL, NULL },
-	{ 15, 3, C_HOLDOFF,	I_OTH, 3, NULL, &cfg.holdoff, NULL },
-	{ 18, 3, C_HOLDOFF_U,	I_SEL, 0, NULL, &cfg.holdoff_unit, &durations },
+static const struct control oneshot_controls[NUM_CONTROLS_ONESHOT] PROGMEM = {
+	{ 0,  0, -1,		I_LAB, 0, "Mode:", NULL },
+	{ 5,  0, C_MODE,	I_SEL, 0, "", &modes },
+	{ 13, 0, C_READY,	I_SEL, 0, "", &ready },
+
+	{ 0,  1, -1,		I_LAB, 0, "TRIG:", NULL },
+	{ 5,  1, C_TRIG_IN1,	I_SEL, 0, "", &triggers },
+	{ 7,  1, C_TRIG_COMBINE,I_SEL, 0, "", &combines },
+	{ 8,  1, C_TRIG_IN2,	I_SEL, 0, "", &triggers },
+	{ 12, 1, -1,		I_LAB, 0, "Out:", NULL },
+	{ 16, 1, C_OUTPUT,	I_OTH, 4, "", &outputs },
+
+	{ 0,  2, -1,		I_LAB, 0, "Wait:", NULL },
+	{ 5,  2, C_WAIT,	I_INT, 3, "", NULL },
+	{ 8,  2, C_WAIT_U,	I_SEL, 0, "", &durations },
+	{ 11, 2, -1,		I_LAB, 0, "CH2:", NULL },
+	{ 15, 2, C_WAIT2,	I_INT, 3, "", NULL },
+	{ 18, 2, C_WAIT2_U,	I_SEL, 0, "", &durations },
+
+	{ 0,  3, -1,		I_LAB, 0, "Dur:", NULL },
+	{ 4,  3, C_ON,		I_INT, 3, "", NULL },
+	{ 7,  3, C_ON_U,	I_SEL, 0, "", &durations },
+	{ 10, 3, -1,		I_LAB, 0, "Hold:", NULL },
+	{ 15, 3, C_HOLDOFF,	I_OTH, 3, "", NULL },
+	{ 18, 3, C_HOLDOFF_U,	I_SEL, 0, "", &durations },
 };
 
 /*
@@ -169,38 +207,38 @@ static const struct control oneshot_controls[NUM_CONTROLS_ONESHOT] = {
  *
  * +--------------------+
  * |Mode:strobe   READY |
- * |TRIG:~1&~2  OUT:dual|
+ * |TRIG:~1&~2  Out:+25%|
  * |WAIT:XXXus DUR:XXXus|
  * |FREQ:XXXMHz ON:XXXus|
  * +--------------------+
  */
 #define NUM_CONTROLS_STROBE		21
 #define CONTROL_STROBE_STARTPOS		2 /* ready */
-static const struct control strobe_controls[NUM_CONTROLS_STROBE] = {
-	{ 0,  0, -1,		I_LAB, 0, "Mode:", NULL, NULL },
-	{ 5,  0, C_MODE,	I_SEL, 0, NULL, &cfg.mode, &modes },
-	{ 13, 0, C_READY,	I_SEL, 0, NULL, &cfg.ready, &ready },
-
-	{ 0,  1, -1,		I_LAB, 0, "TRIG:", NULL, NULL },
-	{ 5,  1, C_TRIG_IN1,	I_SEL, 0, NULL, &cfg.trigger[0], &triggers },
-	{ 7,  1, C_TRIG_COMBINE,I_SEL, 0, NULL, &cfg.combine, &combines },
-	{ 8,  1, C_TRIG_IN2,	I_SEL, 0, NULL, &cfg.trigger[1], &triggers },
-	{ 12, 1, -1,		I_LAB, 0, "Out:", NULL, NULL },
-	{ 16, 1, C_OUTPUT,	I_SEL, 0, NULL, &cfg.output, &outputs },
-
-	{ 0,  2, -1,		I_LAB, 0, "Wait:", NULL, NULL },
-	{ 5,  2, C_WAIT,	I_INT, 3, NULL, &cfg.wait, NULL },
-	{ 8,  2, C_WAIT_U,	I_SEL, 0, NULL, &cfg.wait_unit, &durations },
-	{ 11, 2, -1,		I_LAB, 0, "Dur:", NULL, NULL },
-	{ 15, 2, C_DURATION,	I_INT, 3, NULL, &cfg.len, NULL },
-	{ 18, 2, C_DURATION_U,	I_SEL, 0, NULL, &cfg.len_unit, &durations },
-
-	{ 0,  3, -1,		I_LAB, 0, "Freq:", NULL, NULL },
-	{ 5,  3, C_FREQ,	I_INT, 3, NULL, &cfg.freq, NULL },
-	{ 8,  3, C_FREQ_U,	I_SEL, 0, NULL, &cfg.freq_unit, &rates },
-	{ 12, 3, -1,		I_LAB, 0, "On:", NULL, NULL },
-	{ 15, 3, C_ON,		I_INT, 3, NULL, &cfg.on, NULL },
-	{ 18, 3, C_ON_U,	I_SEL, 0, NULL, &cfg.on_unit, &durations },
+static const struct control strobe_controls[NUM_CONTROLS_STROBE] PROGMEM = {
+	{ 0,  0, -1,		I_LAB, 0, "Mode:", NULL },
+	{ 5,  0, C_MODE,	I_SEL, 0, "", &modes },
+	{ 13, 0, C_READY,	I_SEL, 0, "", &ready },
+
+	{ 0,  1, -1,		I_LAB, 0, "TRIG:", NULL },
+	{ 5,  1, C_TRIG_IN1,	I_SEL, 0, "", &triggers },
+	{ 7,  1, C_TRIG_COMBINE,I_SEL, 0, "", &combines },
+	{ 8,  1, C_TRIG_IN2,	I_SEL, 0, "", &triggers },
+	{ 12, 1, -1,		I_LAB, 0, "Out:", NULL },
+	{ 16, 1, C_OUTPUT,	I_OTH, 4, "", &outputs },
+
+	{ 0,  2, -1,		I_LAB, 0, "Wait:", NULL },
+	{ 5,  2, C_WAIT,	I_INT, 3, "", NULL },
+	{ 8,  2, C_WAIT_U,	I_SEL, 0, "", &durations },
+	{ 11, 2, -1,		I_LAB, 0, "Dur:", NULL },
+	{ 15, 2, C_DURATION,	I_INT, 3, "", NULL },
+	{ 18, 2, C_DURATION_U,	I_SEL, 0, "", &durations },
+
+	{ 0,  3, -1,		I_LAB, 0, "Freq:", NULL },
+	{ 5,  3, C_FREQ,	I_INT, 3, "", NULL },
+	{ 8,  3, C_FREQ_U,	I_SEL, 0, "", &rates },
+	{ 12, 3, -1,		I_LAB, 0, "On:", NULL },
+	{ 15, 3, C_ON,		I_INT, 3, "", NULL },
+	{ 18, 3, C_ON_U,	I_SEL, 0, "", &durations },
 };
 
 /*
@@ -226,49 +264,200 @@ control_skipped(int id)
 }
 
 /*
- * Look up the index of the next control. 'current' is the index of the
- * current control. This handles controls that are disabled by the current
- * configuration (e.g. units for holdoff when manual holdoff selected).
- * If 'dec' is set then decrement rather than increment the control.
+ * The setting edited by control 'id'. Settings are bitfields and bytes
+ * in the packed config, so controls name them rather than point at them.
+ */
+static int
+setting_get(int id)
+{
+	switch (id) {
+	case C_MODE:		return cfg.mode;
+	case C_READY:		return cfg.ready;
+	case C_TRIG_IN1:	return cfg.trigger[0];
+	case C_TRIG_COMBINE:	return cfg.combine;
+	case C_TRIG_IN2:	return cfg.trigger[1];
+	case C_OUTPUT:		/* OUT_PHASE is followed by each lag */
+		return cfg.output + (cfg.output == OUT_PHASE ? cfg.phase : 0);
+	case C_WAIT:		return cfg.wait;
+	case C_WAIT_U:		return cfg.wait_unit;
+	case C_WAIT2:		return cfg.wait2;
+	case C_WAIT2_U:		return cfg.wait2_unit;
+	case C_ON:		return cfg.on;
+	case C_ON_U:		return cfg.on_unit;
+	case C_FREQ:		return cfg.freq;
+	case C_FREQ_U:		return cfg.freq_unit;
+	case C_DURATION:	return cfg.len;
+	case C_DURATION_U:	return cfg.len_unit;
+	case C_HOLDOFF:		return cfg.holdoff;
+	case C_HOLDOFF_U:	return cfg.holdoff_unit;
+	}
+	return 0;
+}
+
+static void
+setting_set(int id, int v)
+{
+	switch (id) {
+	case C_MODE:
+		cfg.mode = v;
+		/* Oneshots only drive the channels together or one at a time */
+		if (cfg.mode == MODE_ONESHOT && cfg.output > OUT_BOTH)
+			cfg.output = OUT_BOTH;
+		break;
+	case C_READY:		cfg.ready = v; break;
+	case C_TRIG_IN1:	cfg.trigger[0] = v; break;
+	case C_TRIG_COMBINE:	cfg.combine = v; break;
+	case C_TRIG_IN2:	cfg.trigger[1] = v; break;
+	case C_OUTPUT:
+		cfg.output = v < OUT_PHASE ? v : OUT_PHASE;
+		if (v >= OUT_PHASE)
+			cfg.phase = v - OUT_PHASE;
+		break;
+	case C_WAIT:		cfg.wait = v; break;
+	case C_WAIT_U:		cfg.wait_unit = v; break;
+	case C_WAIT2:		cfg.wait2 = v; break;
+	case C_WAIT2_U:		cfg.wait2_unit = v; break;
+	case C_ON:		cfg.on = v; break;
+	case C_ON_U:		cfg.on_unit = v; break;
+	case C_FREQ:		cfg.freq = v; break;
+	case C_FREQ_U:		cfg.freq_unit = v; break;
+	case C_DURATION:	cfg.len = v; break;
+	case C_DURATION_U:	cfg.len_unit = v; break;
+	case C_HOLDOFF:		cfg.holdoff = v; break;
+	case C_HOLDOFF_U:	cfg.holdoff_unit = v; break;
+	}
+}
+
+/* Copy control 'i' of the current mode's layout out of flash */
+static void
+get_control(size_t i, struct control *ctrl)
+{
+	memcpy_P(ctrl, cfg.mode == MODE_ONESHOT ?
+	    &oneshot_controls[i] : &strobe_controls[i], sizeof(*ctrl));
+}
+
+/* ID of control 'i' of the current mode's layout */
+static int
+control_id(size_t i)
+{
+	return (int)pgm_read_word(cfg.mode == MODE_ONESHOT ?
+	    &oneshot_controls[i].id : &strobe_controls[i].id);
+}
+
+/*
+ * Look up the index of the control 'delta' controls away from 'current'.
+ * This handles controls that are disabled by the current configuration
+ * (e.g. units for holdoff when manual holdoff selected).
  */
 static uint8_t
-incdec_control(int current, int dec)
+incdec_control(int current, int delta)
 {
 	int v;
-	const struct control *controls = cfg.mode == MODE_ONESHOT ?
-	    oneshot_controls : strobe_controls;
 	size_t control_max = cfg.mode == MODE_ONESHOT ?
 	    NUM_CONTROLS_ONESHOT : NUM_CONTROLS_STROBE;
 
-	do {
-		if (current == 0 && dec)
-			current = control_max - 1;
-		else {
-			current = dec ? (current - 1) : (current + 1);
-			current %= control_max;
-		}
-	} while (control_skipped(controls[current].id));
+	for (; delta != 0; delta += delta < 0 ? 1 : -1) {
+		do {
+			if (current == 0 && delta < 0)
+				current = control_max - 1;
+			else {
+				current += delta < 0 ? -1 : 1;
+				current %= control_max;
+			}
+		} while (control_skipped(control_id(current)));
+	}
 
 	return current;
 }
 
+/* Copy label 'v' of selection 'sel' out of flash */
+static const char *
+sel_label(const struct selection *sel, int v, char *buf, size_t len)
+{
+	return strncpy_P(buf, sel->labels[v], len);
+}
+
+/*
+ * Check cfg as the engine and trigger compilers would. This runs for
+ * every event, so it's skipped if cfg hasn't changed since last time.
+ */
 static void
-draw(uint8_t active, int *active_x, int *active_y)
+validate(void)
+{
+	static struct config checked;
+	static uint8_t have_checked;
+
+	if (have_checked && config_equal(&cfg, &checked))
+		return;
+	checked = cfg;
+	have_checked = 1;
+	problem = schedule_timing(&cfg, &timing);
+	if (problem == SCHED_OK && trigger_check(&cfg) != 0)
+		problem = PROBLEM_TRIGGER;
+}
+
+/*
+ * Show what cfg will really produce on the top line, in place of the
+ * mode and ready controls: the problem if it's invalid, otherwise the
+ * achieved strobe frequency, duty cycle and frequency error, notice
+ * that a pulse was cut short or the width a oneshot pulse rounds to.
+ */
+static void
+draw_status(void)
+{
+	char lbuf[SEL_LABEL_LEN], sbuf[LCD_COLS + 1];
+
+	lcd_moveto(0, 0);
+	if (problem != SCHED_OK)
+		lcd_string_P(problems[problem]);
+	else if (timing.on != timing.want_on)
+		lcd_string_P(PSTR("~ pulse cut to fit"));
+	else if (cfg.mode == MODE_STROBE) {
+		status_strobe(sbuf, timing.freq_x10k,
+		    sel_label(&rates, cfg.freq_unit, lbuf, sizeof(lbuf)),
+		    cycles_div(timing.on * 100 + timing.period / 2,
+		    timing.period), timing.freq_ppm);
+		lcd_string(sbuf);
+	} else {
+		/* Only nanoseconds round; say to what */
+		status_pulse(sbuf, cfg.on,
+		    sel_label(&durations, cfg.on_unit, lbuf, sizeof(lbuf)),
+		    timing.on_exact, timing.on_exact ? 0 :
+		    cycles_dur(timing.on, DUR_NANOSEC));
+		lcd_string(sbuf);
+	}
+	lcd_clear_eol();
+}
+
+/*
+ * Draw the controls. If 'status' is set the top line shows the status
+ * from draw_status() instead of its controls.
+ */
+static void
+draw(uint8_t active, int status, int *active_x, int *active_y)
 {
 	size_t i, l, w;
-	int x, y, cursor_x, cursor_y;
-	char nbuf[16];
+	int x, y, v, cursor_x, cursor_y;
+	char nbuf[16], lbuf[SEL_LABEL_LEN];
 	const char *s;
-	const struct control *controls = cfg.mode == MODE_ONESHOT ?
-	    oneshot_controls : strobe_controls;
+	struct control c, next;
+	const struct control *ctrl = &c, *next_ctrl;
+	const struct selection *sel;
 	size_t control_max = cfg.mode == MODE_ONESHOT ?
 	    NUM_CONTROLS_ONESHOT : NUM_CONTROLS_STROBE;
 
 	cursor_x = cursor_y = -1;
+	if (status)
+		draw_status();
 	for (i = 0; i < control_max; i++) {
-		const struct control *ctrl = &controls[i];
-		const struct control *next_ctrl = (i + 1 > control_max) ?
-		    &controls[i + 1] : NULL;
+		get_control(i, &c);
+		if (status && ctrl->y == 0)
+			continue;
+		next_ctrl = NULL;
+		if (i + 1 > control_max) {
+			get_control(i + 1, &next);
+			next_ctrl = &next;
+		}
 
 		/* Don't draw skipped controls */
 		if (ctrl->id != -1 && control_skipped(ctrl->id)) {
@@ -289,18 +478,19 @@ draw(uint8_t active, int *active_x, int *active_y)
 			cursor_y = ctrl->y;
 		}
 		/* Draw control */
+		v = setting_get(ctrl->id);
 		lcd_moveto(ctrl->x, ctrl->y);
 		switch (ctrl->type) {
 		case I_LAB:
 			lcd_string(ctrl->label);
 			break;
 		case I_INT:
-			s = ntod(*ctrl->value);
+			s = ntod(v);
 			w = ctrl->int_width;
  draw_string:
 			l = strlen(s);
 			if (w >= sizeof(nbuf) || l > w) {
-				lcd_string("BAD WIDTH");
+				lcd_string_P(PSTR("BAD WIDTH"));
 				return;
 			}
 			lcd_string(rjustify(s, nbuf, w + 1));
@@ -309,22 +499,38 @@ draw(uint8_t active, int *active_x, int *active_y)
 				cursor_x += w - l;
 			break;
 		case I_SEL:
-			s = ctrl->selection->labels[*ctrl->value];
-			w = ctrl->selection->width;
-			if (*ctrl->value < 0 || ctrl->selection == NULL ||
-			    (size_t)*ctrl->value > ctrl->selection->n) {
-				lcd_string("BAD SELECTION");
+			sel = ctrl->selection;
+			if (v < 0 || sel == NULL ||
+			    v >= pgm_read_byte(&sel->n)) {
+				lcd_string_P(PSTR("BAD SELECTION"));
 				return;
 			}
+			if (ctrl->id == C_READY && problem != SCHED_OK)
+				s = strcpy_P(lbuf, PSTR("invalid"));
+			else
+				s = strncpy_P(lbuf, sel->labels[v],
+				    sizeof(lbuf));
+			w = pgm_read_byte(&sel->width);
 			goto draw_string;
 		case I_OTH:
 			/* XXX Abstract special cases into a struct? */
 			switch (ctrl->id) {
 			case C_HOLDOFF:
-				if (*ctrl->value == -1)
-					s = "MAN";
+				if (v == -1)
+					s = strcpy_P(lbuf, PSTR("MAN"));
 				else
-					s = ntod(*ctrl->value);
+					s = ntod(v);
+				w = ctrl->int_width;
+				goto draw_string;
+			case C_OUTPUT:
+				if (v < OUT_PHASE) {
+					s = sel_label(ctrl->selection, v,
+					    lbuf, sizeof(lbuf));
+				} else {
+					lbuf[0] = '+';
+					strcpy(lbuf + 1, ntod(v - OUT_PHASE));
+					s = strcat(lbuf, "%");
+				}
 				w = ctrl->int_width;
 				goto draw_string;
 			}
@@ -337,12 +543,36 @@ draw(uint8_t active, int *active_x, int *active_y)
 		*active_y = cursor_y;
 }
 
+/*
+ * Step 'v' in [0:range) by 'incr'. Single steps wrap around; larger
+ * (accelerated or fast) ones stop at the ends of the range.
+ */
+static int
+step_value(int v, int incr, int range)
+{
+	v += incr;
+	if (v >= 0 && v < range)
+		return v;
+	if (incr == 1 || incr == -1)
+		return v < 0 ? v + range : v - range;
+	return v < 0 ? 0 : range - 1;
+}
+
+/*
+ * Adjust the value of control 'active' by 'delta' detents. Numeric values
+ * step by 'scaled', the turn with acceleration applied, or by 50 per
+ * detent if 'fast' is set.
+ */
 void
-edit(int active, int decrement, int fast)
+edit(int active, int delta, int scaled, int fast)
 {
-	const int incr = fast ? 50 : 1;
-	const struct control *ctrl = &(cfg.mode == MODE_ONESHOT ?
-	    oneshot_controls : strobe_controls)[active];
+	const int incr = fast ? delta * 50 : scaled;
+	struct control c;
+	const struct control *ctrl = &c;
+	int n, v;
+
+	get_control(active, &c);
+	v = setting_get(ctrl->id);
 
 	switch (ctrl->type) {
 	case I_LAB:
@@ -354,90 +584,245 @@ edit(int active, int decrement, int fast)
 		case C_ON:
 		case C_FREQ:
 		case C_DURATION:
-			/* XXX: All values are [0:1000) for the moment */
-			if (decrement)
-				*ctrl->value -= incr;
-			else
-				*ctrl->value += incr;
-			if (*ctrl->value < 0)
-				*ctrl->value += 1000;
-			else
-				*ctrl->value %= 1000;
+			setting_set(ctrl->id,
+			    step_value(v, incr, CONFIG_VALUE_MAX));
 			break;
 		}
 		break;
 	case I_SEL:
-		if (decrement)
-			*ctrl->value -= 1;
-		else
-			*ctrl->value += 1;
-		if (*ctrl->value < 0)
-			*ctrl->value += ctrl->selection->n;
-		else
-			*ctrl->value %= ctrl->selection->n;
+		n = pgm_read_byte(&ctrl->selection->n);
+		v = (v + delta) % n;
+		if (v < 0)
+			v += n;
+		setting_set(ctrl->id, v);
 		break;
 	case I_OTH:
 		switch (ctrl->id) {
 		case C_HOLDOFF:
-			if (decrement) {
-				if (*ctrl->value == 0)
-					*ctrl->value = -1; /* "manual" */
-				else
-					*ctrl->value -= incr;
-			} else {
-				if (*ctrl->value == 999)
-					*ctrl->value = -1;
-				else
-					*ctrl->value += incr;
-			}
-			if (*ctrl->value < -1)
-				*ctrl->value += 1001;
-			else if (*ctrl->value > 0)
-				*ctrl->value %= 1000;
+			/* Values plus -1 for "manual" between 999 and 0 */
+			setting_set(ctrl->id,
+			    step_value(v + 1, incr, CONFIG_VALUE_MAX + 1) - 1);
+			break;
+		case C_OUTPUT:
+			/* Strobes go on past "alt" through each phase lag */
+			n = cfg.mode == MODE_ONESHOT ? OUT_BOTH + 1 :
+			    OUT_PHASE + PHASE_MAX;
+			setting_set(ctrl->id, step_value(v, incr, n));
 			break;
 		}
 		break;
 	}
 }
 
+/* Holding the encoder button this long (ms) is a long press */
+#define LONG_PRESS_MS	750
+
+/* Summarise preset 'c' on one line */
+static void
+describe(const struct config *c)
+{
+	char lbuf[SEL_LABEL_LEN];
+
+	lcd_string(sel_label(&modes, c->mode, lbuf, sizeof(lbuf)));
+	lcd_char(' ');
+	if (c->mode == MODE_STROBE) {
+		lcd_string(ntod(c->freq));
+		lcd_string(sel_label(&rates, c->freq_unit, lbuf, sizeof(lbuf)));
+		lcd_char(' ');
+		lcd_string(ntod(c->len));
+		lcd_string(sel_label(&durations, c->len_unit,
+		    lbuf, sizeof(lbuf)));
+	} else {
+		lcd_string(ntod(c->wait));
+		lcd_string(sel_label(&durations, c->wait_unit,
+		    lbuf, sizeof(lbuf)));
+		lcd_char(' ');
+		lcd_string(ntod(c->on));
+		lcd_string(sel_label(&durations, c->on_unit,
+		    lbuf, sizeof(lbuf)));
+	}
+}
+
+/*
+ * Preset screen: turn to choose a preset, press to recall it, hold to
+ * save the current settings over it, or press the second button to go
+ * back. A recalled preset replaces 'cfg' and is armed straight away.
+ * Returns 1 if a preset was recalled.
+ */
+static int
+preset_menu(void)
+{
+	uint8_t n = 0, held = 0, valid;
+	uint8_t ev_type, ev_v1, ev_v2;
+	uint16_t pressed = 0;
+	int16_t scaled;
+	struct config p;
+
+	lcd_display(1, 0, 0);
+	for (;;) {
+		valid = persist_preset_load(n, &p) == 0;
+		lcd_clear();
+		lcd_string_P(PSTR("Preset "));
+		lcd_string(ntod(n + 1));
+		lcd_moveto(0, 1);
+		if (valid)
+			describe(&p);
+		else
+			lcd_string_P(PSTR("(empty)"));
+		lcd_moveto(0, 2);
+		lcd_string_P(PSTR("press:load hold:save"));
+		lcd_moveto(0, 3);
+		lcd_string_P(PSTR("button 2: back"));
+		lcd_flush();
+
+		event_sleep(SLEEP_MODE_IDLE, &ev_type, &ev_v1, &ev_v2, NULL);
+		switch (ev_type) {
+		case EV_ENCODER:
+			n = step_value(n, encoder_delta(&scaled),
+			    PERSIST_PRESETS);
+			break;
+		case EV_BUTTON:
+			if (ev_v1 == 1 && ev_v2 == 0)
+				return 0;
+			if (ev_v1 != 0)
+				break;
+			if (ev_v2 == 1) {
+				pressed = tick_now();
+				held = 1;
+				break;
+			}
+			if (!held)
+				break;
+			held = 0;
+			if ((uint16_t)(tick_now() - pressed) >= LONG_PRESS_MS)
+				persist_preset_save(n, &cfg);
+			else if (valid) {
+				cfg = p;
+				cfg.ready = READY_YES;
+				return 1;
+			}
+			break;
+		}
+	}
+}
+
+/* One line of calib_screen(): the figure in use and as measured */
+static void
+calib_line(uint8_t y, const char *label, uint16_t use, uint16_t got)
+{
+	char nbuf[8];
+
+	lcd_moveto(0, y);
+	lcd_string_P(label);
+	lcd_string(rjustify(ntod(use), nbuf, 4));
+	lcd_string(rjustify(ntod(got), nbuf, 4));
+}
+
+/*
+ * Diagnostics: the busy-wait overheads measured at boot and those in use,
+ * which differ only if the measurement was rejected. Any button returns.
+ */
+static void
+calib_screen(void)
+{
+	uint8_t ev_type, ev_v1, ev_v2;
+
+	lcd_display(1, 0, 0);
+	lcd_clear();
+	lcd_string_P(PSTR("Wait cycles  use got"));
+	calib_line(1, PSTR("fixed       "), wait_cal.fixed,
+	    wait_measured.fixed);
+	calib_line(2, PSTR("nop sled    "), wait_cal.tiny,
+	    wait_measured.tiny);
+	lcd_flush();
+	do {
+		event_sleep(SLEEP_MODE_IDLE, &ev_type, &ev_v1, &ev_v2, NULL);
+		/* Turns are ignored, but must be collected */
+		if (ev_type == EV_ENCODER)
+			(void)encoder_delta(NULL);
+	} while (ev_type != EV_BUTTON || ev_v2 != 0);
+}
+
 void
 config_edit(void)
 {
 	uint8_t active = cfg.mode == MODE_ONESHOT ?
 	    CONTROL_ONESHOT_STARTPOS : CONTROL_STROBE_STARTPOS;
-	uint8_t editing = 0, button_down = 0;
+	uint8_t editing = 0, button_down = 0, held = 0;
 	uint8_t ev_type, ev_v1, ev_v2;
-	int omode, i, active_x, active_y;
+	int omode, i, delta, active_x, active_y;
+	int16_t scaled;
+	uint16_t pressed = 0, pressed2 = 0;
+	struct control c;
 
 	lcd_moveto(0, 0);
 	lcd_clear();
 
 	while (1) {
+		/* Only a valid configuration may be armed */
+		validate();
+		if (problem != SCHED_OK)
+			cfg.ready = READY_NO;
 		active_x = active_y = -1;
-		draw(active, &active_x, &active_y);
+		get_control(active, &c);
+		draw(active, editing && c.y != 0, &active_x, &active_y);
 		lcd_display(1, 1, editing ? 0 : 1);
 		if (active_x != -1 && active_y != -1)
 			lcd_moveto(active_x, active_y);
 		else
 			lcd_moveto(LCD_COLS - 1, LCD_ROWS - 1); /* visible */
+		lcd_flush();
 		if (cfg.ready & !editing)
 			break;
 		event_sleep(SLEEP_MODE_IDLE, &ev_type, &ev_v1, &ev_v2, NULL);
 		omode = cfg.mode;
 		switch (ev_type) {
 		case EV_ENCODER:
+			/* Apply the whole turn in one redraw */
+			delta = encoder_delta(&scaled);
 			if (editing)
-				edit(active, ev_v1 ? 0 : 1, button_down);
+				edit(active, delta, scaled, button_down);
 			else
-				active = incdec_control(active, ev_v1 ? 0 : 1);
+				active = incdec_control(active, delta);
 			break;
 		case EV_BUTTON:
-			/* Swap editing modes on encoder button up */
-			if (ev_v1 == 0 && ev_v2 == 0)
+			if (ev_v1 == 0 && ev_v2 == 1) {
+				pressed = tick_now();
+				held = 1;
+			}
+			/*
+			 * Swap editing modes on encoder button up, or open
+			 * the presets after a long press.
+			 */
+			if (ev_v1 == 0 && ev_v2 == 0 && held) {
+				held = 0;
+				if (!editing && (uint16_t)(tick_now() -
+				    pressed) >= LONG_PRESS_MS) {
+					/* Arms at once if one is recalled */
+					preset_menu();
+					lcd_clear();
+					break;
+				}
 				editing = !editing;
-			/* Record state of 2nd button for fast editing */
-			if (ev_v1 == 1)
+				/* Done with this value; save in background */
+				if (!editing)
+					persist_save(&cfg);
+			}
+			/*
+			 * Record state of 2nd button for fast editing; a long
+			 * press outside editing shows the calibration.
+			 */
+			if (ev_v1 == 1) {
+				if (ev_v2 == 1)
+					pressed2 = tick_now();
+				else if (button_down && !editing &&
+				    (uint16_t)(tick_now() - pressed2) >=
+				    LONG_PRESS_MS) {
+					calib_screen();
+					lcd_clear();
+				}
 				button_down = ev_v2;
+			}
 			break;
 		}
 		if (omode != cfg.mode)
@@ -448,5 +833,5 @@ config_edit(void)
 void
 reset_config(void)
 {
-	cfg = default_config;
+	memcpy_P(&cfg, &default_config, sizeof(cfg));
 }
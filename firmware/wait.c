@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <string.h>
+
+#include "wait.h"
+
+struct wait_cal wait_cal = { WAIT_CAL_FIXED, WAIT_CAL_TINY };
+struct wait_cal wait_measured;
+
+void
+prepare_wait(uint32_t t, struct longwait *lw)
+{
+	memset(lw, 0, sizeof(*lw));
+	/* Tiny delays use nop sled */
+	if (t < WAIT_SLED || t < wait_cal.fixed) {
+		t = t < wait_cal.tiny ? 0 : t - wait_cal.tiny;
+		lw->tiny = WAIT_SLED - (t < WAIT_SLED ? t : WAIT_SLED - 1);
+		return;
+	}
+	/* Take off the cycles for comparisons; see wait_calibrate() */
+	t -= wait_cal.fixed;
+	lw->t50m = t / 50000000; /* ~max 256*3 cycles that fit a u16 */
+	t %= 50000000;
+	lw->t768 = t / WAIT_LAP; /* Max _delay_loop_1() = 236*3 cycles */
+	t %= WAIT_LAP;
+	lw->t3 = t / 3; /* _delay_loop_1() takes 3 cycles per loop */
+}
+
+/* Not inlined, so every call times the same code */
+uint16_t __attribute__((noinline))
+wait_time(const struct longwait *p)
+{
+	struct longwait lw = *p;
+	uint16_t start;
+
+	start = TCNT1;
+	LONG_WAIT(lw);
+	return TCNT1 - start;
+}
+
+/* The same without the wait: the cost of reading the counter */
+static uint16_t __attribute__((noinline))
+time_nothing(void)
+{
+	uint16_t start;
+
+	start = TCNT1;
+	__asm__ volatile ("" ::: "memory");
+	return TCNT1 - start;
+}
+
+int
+wait_calibrate(uint16_t (*time)(const struct longwait *lw))
+{
+	struct longwait lw;
+	struct wait_cal *m = &wait_measured;
+	uint16_t base;
+	uint8_t tccr1b = TCCR1B;
+
+	TCCR1B = (1 << CS10);
+	base = time_nothing();
+
+	/* Sled with every nop skipped */
+	memset(&lw, 0, sizeof(lw));
+	lw.tiny = WAIT_SLED;
+	m->tiny = time(&lw) - base;
+
+	/* One pass of the 3 cycle loop */
+	memset(&lw, 0, sizeof(lw));
+	lw.t3 = 1;
+	m->fixed = time(&lw) - base - 3;
+
+	TCCR1B = tccr1b;
+
+	if (wait_cal_check(m) != 0)
+		return -1;
+	wait_cal = *m;
+	return 0;
+}
+
+int
+wait_cal_check(const struct wait_cal *c)
+{
+	/*
+	 * Anything far from the hand-found figures means the measurement,
+	 * not the build, is off. They were found for LONG_WAIT() alone, and a
+	 * calibration may also count a call and a port write around it.
+	 */
+	if (c->tiny < 4 || c->tiny > 3 * WAIT_CAL_TINY ||
+	    c->fixed < 8 || c->fixed > 2 * WAIT_CAL_FIXED)
+		return -1;
+	/*
+	 * prepare_wait() sends delays under 'fixed' down the sled, which
+	 * only reaches tiny + WAIT_SLED - 1.
+	 */
+	if (c->fixed > c->tiny + WAIT_SLED)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,152 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * prepare_wait() / LONG_WAIT() implement busy-wait delays accurate to
+ * 6 cycles over ranges up to ~1k sec. The output engine uses them for
+ * delays too short to be turned around by the Timer1 interrupt handler.
+ *
+ * The overheads of LONG_WAIT() depend on the code the compiler makes of
+ * each instance of it, so wait_calibrate() measures those of the one the
+ * output engine runs against Timer1 at boot, rather than trusting figures
+ * found by hand for one build.
+ */
+
+#include <stdint.h>
+#include <util/delay_basic.h>
+
+struct longwait {
+	uint32_t t50m;
+	uint16_t t768;
+	uint8_t t3;
+	uint8_t tiny;
+};
+
+/* Overheads of LONG_WAIT(), in cycles */
+struct wait_cal {
+	uint16_t fixed;		/* Loop path, less its loops */
+	uint16_t tiny;		/* Nop sled path, less its nops */
+};
+
+/* Found by hand for the original build; used until calibrated */
+#define WAIT_CAL_FIXED	36
+#define WAIT_CAL_TINY	14
+
+/*
+ * Length of the nop sled, and the delay in and cycles per pass of the
+ * long loop. The pass isn't calibrated: the engine only uses LONG_WAIT()
+ * below OUTPUT_MIN_PACED_CYCLES, which never reaches the long loop.
+ */
+#define WAIT_SLED	40
+#define WAIT_LAP_DELAY	762
+#define WAIT_LAP	768
+
+/* What prepare_wait() uses, and what wait_calibrate() last measured */
+extern struct wait_cal wait_cal, wait_measured;
+
+/*
+ * Time a LONG_WAIT() instance against Timer1 into wait_measured and, if
+ * the result is plausible, start using it. 'time' returns the cycles
+ * between two counter reads around that instance waiting 'lw'; see
+ * output_time_wait(). Returns 0 if the result was used or -1 if not.
+ * Must be called with interrupts disabled and before Timer1 is in use.
+ */
+int wait_calibrate(uint16_t (*time)(const struct longwait *lw));
+
+/*
+ * Returns 0 if calibration 'c' is plausible and prepare_wait() can be
+ * exact with it, or -1 if not.
+ */
+int wait_cal_check(const struct wait_cal *c);
+
+/* A 'time' for wait_calibrate() around an instance of its own */
+uint16_t wait_time(const struct longwait *lw);
+
+/* Precompute the loop counts to busy-wait for 't' cycles */
+void prepare_wait(uint32_t t, struct longwait *lw);
+
+#define LONG_WAIT(lw) do { \
+	uint32_t __i; \
+	uint16_t __j; \
+	\
+	if (lw.tiny != 0) { \
+		/* Really short delays jump into a nop sled */ \
+		__asm__ volatile ( \
+			"ldi r31, pm_hi8(1f)" "\n\t" \
+			"ldi r30, pm_lo8(1f)" "\n\t" \
+			"add r30, %0" "\n\t" \
+			"adc r31, __zero_reg__" "\n\t" \
+			"ijmp" "\n\t" \
+			"1:" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			"nop" "\n\t" \
+			: /* no output */ \
+			: "l" (lw.tiny) \
+			: "r30", "r31" \
+		); \
+	} else { \
+		/* Longer delays use the smallest possible counter */ \
+		for (__i = lw.t50m; __i != 0; __i--) \
+			__builtin_avr_delay_cycles(50000000); \
+		for (__j = lw.t768; __j != 0; __j--) \
+			__builtin_avr_delay_cycles(WAIT_LAP_DELAY); \
+		if (lw.t3 != 0) /* time == 0 means sleep for 256*3 cycles! */ \
+			_delay_loop_1(lw.t3); \
+	} \
+} while (0)
+
+#endif /* WAIT_H */
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Timing benchmark firmware for prepare_wait()/LONG_WAIT(). Run it under
+ * wait_bench_sim ("make bench"); on real hardware the pulses on PA0 can
+ * be measured with a scope instead.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+
+#include "wait.h"
+#include "wait_bench.h"
+
+int
+main(void)
+{
+	struct longwait lw;
+	uint32_t t;
+	uint8_t i;
+
+	cli();
+	DDRA = (1 << WAIT_BENCH_PIN);
+	PORTA = 0;
+	/* Calibrated on wait_time(), standing in for the inlined wait below */
+	(void)wait_calibrate(wait_time);
+	for (i = 0; (t = wait_bench_delay(i)) != 0; i++) {
+		/* Loop counts are precomputed, as in the output engine */
+		prepare_wait(t, &lw);
+		PORTA = (1 << WAIT_BENCH_PIN);
+		LONG_WAIT(lw);
+		PORTA = 0;
+	}
+	/* Sleeping with interrupts off ends the simulation */
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_enable();
+	sleep_cpu();
+	for (;;)
+		;
+}
@@ -0,0 +1,55 @@
+#ifndef WAIT_BENCH_H
+#define WAIT_BENCH_H
+
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Delay sweep shared by the wait_bench firmware and the wait_bench_sim
+ * host harness. The firmware plays each delay as a pulse on PA0: set,
+ * LONG_WAIT(), clear. The harness timestamps the edges in simavr and
+ * matches each pulse to its requested delay by index.
+ */
+
+#include <stdint.h>
+
+#define WAIT_BENCH_PIN		0	/* PA0 */
+#define WAIT_BENCH_LINEAR	64	/* Every delay from 1 to this */
+
+/*
+ * Returns the 'i'th delay of the sweep, or 0 at the end. After the
+ * linear section it takes 2^k - 1 and 1.5 * 2^k + 1 for each power of
+ * two up to 2^31, then 2^32 - 1.
+ */
+static inline uint32_t
+wait_bench_delay(uint8_t i)
+{
+	uint8_t k;
+
+	if (i < WAIT_BENCH_LINEAR)
+		return i + 1;
+	i -= WAIT_BENCH_LINEAR;
+	k = 7 + i / 2;
+	if (k == 32 && i % 2 == 0)
+		return 0xffffffffUL;
+	if (k >= 32)
+		return 0;
+	if (i % 2 == 0)
+		return ((uint32_t)1 << k) - 1;
+	return ((uint32_t)3 << (k - 1)) + 1;
+}
+
+#endif /* WAIT_BENCH_H */
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2014 Damien Miller <djm@mindrot.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Host harness for the wait_bench firmware: runs it in simavr, times
+ * each pulse on PA0 in CPU cycles and prints a table of requested vs.
+ * actual delays.
+ *
+ * usage: wait_bench_sim [-ps] [-g pin] [-l max-delay] [-m mcu] [-n pulses]
+ *     [-r pin] [-t pin] file.elf
+ *
+ * -p prints the raw width of each pulse, and the cycle it started on,
+ * instead, for other benchmarks that time code between PA0 edges (e.g.
+ * isr_bench). -g holds an input pin, given as port letter and bit (e.g.
+ * "D0"), low; it may be repeated. -n stops after that many pulses, for
+ * firmware that never stops by itself.
+ *
+ * -r finds the shortest period at which pulses on an active-low trigger
+ * input are all answered by a pulse on PA0, for the retrigger bench in
+ * main.c. Each trial boots the firmware afresh, waits for its first PA0
+ * pulse, then sends SWEEP_TRIGGERS trigger pulses.
+ *
+ * -t instead pulls the trigger input low once per trial and times the
+ * next rising edge on PA0, for the latencies in trigger.h. Each trial
+ * moves the trigger a cycle later against the firmware's poll loop.
+ *
+ * -s checks the bursts of the strobe_bench firmware instead: every pulse
+ * must be exactly as wide as asked and rise exactly a period after the
+ * last one of its burst.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <avr_ioport.h>
+
+#include "wait_bench.h"
+#include "strobe_bench.h"
+
+/* Trigger pulses per -r trial, how long each is low, time to settle */
+#define SWEEP_TRIGGERS	64
+#define SWEEP_WIDTH	40
+#define SWEEP_SETTLE	(F_CPU / 1000)
+
+/* -t trials; more than a pass of either trigger poll loop */
+#define LATENCY_PHASES	32
+
+#define MAX_GROUND	4
+
+static elf_firmware_t fw;
+static const char *mcu = "atmega324p";
+static const char *ground[MAX_GROUND];
+static int nground;
+
+static const char *sweep_pin;
+static struct avr_irq_t *sweep_irq;
+static avr_cycle_count_t sweep_period, sweep_end;
+static unsigned sweep_sent, sweep_seen;
+static int sweep_started, sweep_low;
+
+static int latency_mode;
+static unsigned latency_phase;
+static avr_cycle_count_t latency_at, latency;
+
+static int strobe;
+static uint16_t strobe_case;
+static uint32_t strobe_pulse, strobe_n;
+static uint8_t strobe_on, strobe_off;
+static avr_cycle_count_t strobe_rise;
+
+static uint8_t npulse;
+static uint32_t limit = 0xffffffffUL;
+static unsigned long maxpulse;
+static avr_cycle_count_t rise;
+static int finished;
+static int raw;
+
+/* Cycle timer: alternately pull the trigger low and release it */
+static avr_cycle_count_t
+sweep_pulse(avr_t *avr, avr_cycle_count_t when, void *arg)
+{
+	if (sweep_low) {
+		avr_raise_irq(sweep_irq, 1);
+		sweep_low = 0;
+		if (sweep_sent >= SWEEP_TRIGGERS) {
+			sweep_end = when + sweep_period + SWEEP_SETTLE;
+			return 0;
+		}
+		return when + sweep_period - SWEEP_WIDTH;
+	}
+	avr_raise_irq(sweep_irq, 0);
+	sweep_low = 1;
+	sweep_sent++;
+	return when + SWEEP_WIDTH;
+}
+
+/* Cycle timer for -t: pull the trigger low once */
+static avr_cycle_count_t
+latency_pull(avr_t *avr, avr_cycle_count_t when, void *arg)
+{
+	avr_raise_irq(sweep_irq, 0);
+	latency_at = avr->cycle;
+	return 0;
+}
+
+/* -s: check one edge of the current burst */
+static void
+strobe_edge(avr_cycle_count_t now, uint32_t value)
+{
+	if (strobe_pulse == 0 && value &&
+	    !strobe_bench_case(strobe_case, &strobe_on, &strobe_off,
+	    &strobe_n))
+		errx(1, "more bursts than cases");
+	if (value) {
+		if (strobe_pulse != 0 &&
+		    now - strobe_rise != strobe_on + strobe_off)
+			errx(1, "on %u off %u n %u: pulse %u rose after %llu "
+			    "cycles", strobe_on, strobe_off, strobe_n,
+			    strobe_pulse, (unsigned long long)(now -
+			    strobe_rise));
+		strobe_rise = now;
+		return;
+	}
+	if (now - strobe_rise != strobe_on)
+		errx(1, "on %u off %u n %u: pulse %u is %llu cycles",
+		    strobe_on, strobe_off, strobe_n, strobe_pulse,
+		    (unsigned long long)(now - strobe_rise));
+	if (++strobe_pulse < strobe_n)
+		return;
+	printf("%4u %4u %6u ok\n", strobe_on, strobe_off, strobe_n);
+	strobe_pulse = 0;
+	strobe_case++;
+}
+
+static void
+pin_changed(struct avr_irq_t *irq, uint32_t value, void *arg)
+{
+	avr_t *avr = arg;
+	uint32_t want;
+	int64_t actual, error;
+
+	if (strobe) {
+		strobe_edge(avr->cycle, value);
+		return;
+	}
+	if (value) {
+		rise = avr->cycle;
+		if (latency_at != 0 && latency == 0)
+			latency = avr->cycle - latency_at;
+		return;
+	}
+	if (sweep_pin != NULL) {
+		/* The first pulse says the firmware is armed */
+		if (sweep_started)
+			sweep_seen++;
+		else if (latency_mode) {
+			sweep_started = 1;
+			avr_cycle_timer_register(avr,
+			    SWEEP_SETTLE + latency_phase, latency_pull, NULL);
+		} else {
+			sweep_started = 1;
+			avr_cycle_timer_register(avr, sweep_period,
+			    sweep_pulse, NULL);
+		}
+		return;
+	}
+	if (raw) {
+		printf("%3u %10llu %12llu\n", npulse++,
+		    (unsigned long long)(avr->cycle - rise),
+		    (unsigned long long)rise);
+		if (maxpulse != 0 && npulse >= maxpulse)
+			finished = 1;
+		return;
+	}
+	if ((want = wait_bench_delay(npulse++)) == 0)
+		errx(1, "more pulses than delays");
+	actual = avr->cycle - rise;
+	error = actual - (int64_t)want;
+	printf("%10lu %10lld %+8lld %+10.4f%%\n", (unsigned long)want,
+	    (long long)actual, (long long)error, 100.0 * error / want);
+	fflush(stdout);
+	if (wait_bench_delay(npulse) > limit)
+		finished = 1;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: wait_bench_sim [-ps] [-g pin] [-l max-delay] [-m mcu] "
+	    "[-n pulses]\n"
+	    "    [-r pin] [-t pin] file.elf\n");
+	exit(1);
+}
+
+/* Parse a pin given as port letter and bit, e.g. "D0" */
+static const char *
+pin_arg(const char *s)
+{
+	if (strlen(s) != 2 || s[0] < 'A' || s[0] > 'D' || s[1] < '0' ||
+	    s[1] > '7')
+		usage();
+	return s;
+}
+
+/* A freshly loaded simulator with the PA0 probe and -g pins set up */
+static avr_t *
+sim_start(void)
+{
+	avr_ioport_external_t ext;
+	avr_t *avr;
+	int i;
+
+	if ((avr = avr_make_mcu_by_name(mcu)) == NULL)
+		errx(1, "simavr does not support %s", mcu);
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = F_CPU;
+	avr_irq_register_notify(avr_io_getirq(avr,
+	    AVR_IOCTL_IOPORT_GETIRQ('A'), WAIT_BENCH_PIN), pin_changed, avr);
+	for (i = 0; i < nground; i++) {
+		/* An external pull-down that wins whenever it's an input */
+		memset(&ext, 0, sizeof(ext));
+		ext.name = ground[i][0];
+		ext.mask = 1 << (ground[i][1] - '0');
+		ext.value = 0;
+		avr_ioctl(avr, AVR_IOCTL_IOPORT_SET_EXTERNAL(ground[i][0]),
+		    &ext);
+	}
+	return avr;
+}
+
+/*
+ * Returns non-zero if every one of SWEEP_TRIGGERS trigger pulses
+ * 'period' cycles apart was answered by an output pulse.
+ */
+static int
+sweep_trial(avr_cycle_count_t period)
+{
+	avr_t *avr;
+	int state;
+
+	sweep_period = period;
+	sweep_end = 0;
+	sweep_sent = sweep_seen = 0;
+	sweep_started = sweep_low = 0;
+	avr = sim_start();
+	sweep_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(sweep_pin[0]),
+	    sweep_pin[1] - '0');
+	avr_raise_irq(sweep_irq, 1);
+	do {
+		state = avr_run(avr);
+		if (!sweep_started && avr->cycle > 10ULL * F_CPU)
+			errx(1, "firmware never signalled it was armed");
+	} while ((sweep_end == 0 || avr->cycle < sweep_end) &&
+	    state != cpu_Done && state != cpu_Crashed);
+	if (state == cpu_Crashed)
+		errx(1, "simulated CPU crashed");
+	avr_terminate(avr);
+	return sweep_seen == SWEEP_TRIGGERS;
+}
+
+/* Binary search for the shortest period every trigger fires at */
+static void
+sweep(const char *path)
+{
+	avr_cycle_count_t lo = SWEEP_WIDTH * 2, hi = F_CPU / 1000, mid;
+
+	if (!sweep_trial(hi))
+		errx(1, "%s: triggers missed even %llu cycles apart", path,
+		    (unsigned long long)hi);
+	if (sweep_trial(lo))
+		hi = lo;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (sweep_trial(mid))
+			hi = mid;
+		else
+			lo = mid;
+	}
+	printf("%s: %llu cycles (%.2fus) between triggers, %.1fkHz\n", path,
+	    (unsigned long long)hi, hi * 1e6 / F_CPU, F_CPU / 1e3 / hi);
+}
+
+/* Cycles from pulling the trigger low 'phase' cycles late to PA0 rising */
+static avr_cycle_count_t
+latency_trial(unsigned phase)
+{
+	avr_t *avr;
+	int state;
+
+	latency_phase = phase;
+	latency_at = latency = 0;
+	sweep_started = 0;
+	avr = sim_start();
+	sweep_irq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(sweep_pin[0]),
+	    sweep_pin[1] - '0');
+	avr_raise_irq(sweep_irq, 1);
+	do {
+		state = avr_run(avr);
+		if (avr->cycle > 10ULL * F_CPU)
+			errx(1, "no output edge after the trigger");
+	} while (latency == 0 && state != cpu_Done && state != cpu_Crashed);
+	if (state == cpu_Crashed)
+		errx(1, "simulated CPU crashed");
+	if (latency == 0)
+		errx(1, "firmware stopped before the output edge");
+	avr_terminate(avr);
+	return latency;
+}
+
+/* First edge latency over every phase of the poll loop */
+static void
+latencies(const char *path)
+{
+	avr_cycle_count_t l, lo = ~0ULL, hi = 0, sum = 0;
+	unsigned i;
+
+	for (i = 0; i < LATENCY_PHASES; i++) {
+		l = latency_trial(i);
+		lo = l < lo ? l : lo;
+		hi = l > hi ? l : hi;
+		sum += l;
+	}
+	printf("%s: first edge %llu-%llu cycles after the trigger, "
+	    "mean %.1f (%.2fus)\n", path, (unsigned long long)lo,
+	    (unsigned long long)hi, (double)sum / LATENCY_PHASES,
+	    sum * 1e6 / LATENCY_PHASES / F_CPU);
+}
+
+int
+main(int argc, char **argv)
+{
+	avr_t *avr;
+	int ch, state;
+
+	while ((ch = getopt(argc, argv, "g:l:m:n:pr:st:")) != -1) {
+		switch (ch) {
+		case 'g':
+			if (nground >= MAX_GROUND)
+				usage();
+			ground[nground++] = pin_arg(optarg);
+			break;
+		case 'l':
+			limit = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mcu = optarg;
+			break;
+		case 'n':
+			maxpulse = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			raw = 1;
+			break;
+		case 'r':
+			sweep_pin = pin_arg(optarg);
+			break;
+		case 's':
+			strobe = 1;
+			break;
+		case 't':
+			sweep_pin = pin_arg(optarg);
+			latency_mode = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(argv[0], &fw) != 0)
+		errx(1, "could not load %s", argv[0]);
+	if (sweep_pin != NULL) {
+		if (latency_mode)
+			latencies(argv[0]);
+		else
+			sweep(argv[0]);
+		return 0;
+	}
+	avr = sim_start();
+
+	if (strobe)
+		printf("%4s %4s %6s\n", "on", "off", "pulses");
+	else if (raw)
+		printf("%3s %10s %12s\n", "#", "cycles", "at");
+	else {
+		printf("%10s %10s %8s %11s\n",
+		    "requested", "actual", "error", "rel");
+	}
+	do {
+		state = avr_run(avr);
+	} while (!finished && state != cpu_Done && state != cpu_Crashed);
+	if (state == cpu_Crashed)
+		errx(1, "simulated CPU crashed");
+	if (strobe) {
+		if (strobe_bench_case(strobe_case, &strobe_on, &strobe_off,
+		    &strobe_n))
+			errx(1, "stopped at burst %u: on %u off %u n %u",
+			    strobe_case, strobe_on, strobe_off, strobe_n);
+		return 0;
+	}
+	if (!raw && !finished && wait_bench_delay(npulse) != 0)
+		errx(1, "only %u pulses seen", npulse);
+	return 0;
+}